@@ -150,6 +150,27 @@ CODE_ENUM(RTTI_TYPE_DESC,                    "`RTTI Type Descriptor'"),
 CODE_ENUM(RTTI_BASE_CLASS_DESC,              "`RTTI Base Class Descriptor'"),
 CODE_ENUM(RTTI_BASE_CLASS_ARRAY,             "`RTTI Base Class Array'"),
 CODE_ENUM(RTTI_CLASS_HEIRARCHY_DESC,         "`RTTI Class Hierarchy Descriptor'"),
-CODE_ENUM(RTTI_COMPLETE_OBJ_LOCATOR,         "`RTTI Complete Object Locator'")
+CODE_ENUM(RTTI_COMPLETE_OBJ_LOCATOR,         "`RTTI Complete Object Locator'"),
+
+// Itanium C++ ABI types and special names
+CODE_ENUM(LONG_LONG,                         "long long"),
+CODE_ENUM(UNSIGNED_LONG_LONG,                "unsigned long long"),
+CODE_ENUM(FLOAT128,                          "__float128"),
+CODE_ENUM(HALF,                              "half"),
+CODE_ENUM(CHAR8,                             "char8_t"),
+CODE_ENUM(DECIMAL32,                         "decimal32"),
+CODE_ENUM(DECIMAL64,                         "decimal64"),
+CODE_ENUM(DECIMAL128,                        "decimal128"),
+CODE_ENUM(AUTO,                              "auto"),
+CODE_ENUM(DECLTYPE_AUTO,                     "decltype(auto)"),
+CODE_ENUM(OP_SPACESHIP,                      "operator<=>"),
+CODE_ENUM(OP_CO_AWAIT,                       "operator co_await"),
+CODE_ENUM(VTT,                               "`VTT'"),
+CODE_ENUM(CONSTRUCTION_VTABLE,               "`construction vtable'"),
+CODE_ENUM(TYPEINFO_NAME,                     "`typeinfo name'"),
+CODE_ENUM(TLS_WRAPPER,                       "`TLS wrapper function'"),
+CODE_ENUM(TLS_INIT,                          "`TLS init function'"),
+CODE_ENUM(REFERENCE_TEMPORARY,               "`reference temporary'"),
+CODE_ENUM(STRING_LITERAL,                    "`string'")
 
 #undef CODE_ENUM
@@ -21,23 +21,13 @@
 // DM17-0949
 
 #include "codes.hpp"
-#include <vector>
 
 namespace demangle {
 
-namespace {
-
-#define CODE_ENUM(e, s) s
-
-std::vector<char const *> code_strings = {
-  #include "code_data.hpp"
-};
-
-} // unnamed namespace
+constexpr CodeView detail::CodeTable::entries[];
 
 char const * code_string(Code c) {
-  auto v = static_cast<decltype(code_strings)::size_type>(c);
-  return code_strings.at(v);
+  return code_view(c).data;
 }
 
 } // namespace demangle
@@ -23,6 +23,8 @@
 #ifndef Include_codes_hpp
 #define Include_codes_hpp
 
+#include <cstddef>
+
 namespace demangle {
 
 #define CODE_ENUM(e, s) e
@@ -31,6 +33,34 @@ enum class Code : unsigned {
   #include "code_data.hpp"
 };
 
+// The string for a code, along with its length.
+struct CodeView {
+  char const * data;
+  std::size_t size;
+};
+
+namespace detail {
+
+template <std::size_t N>
+constexpr CodeView make_code_view(char const (&s)[N]) {
+  return CodeView{s, N - 1};
+}
+
+// A constant table rather than a vector, so that the strings can be used at compile time, and
+// during static initialization.  Defined in codes.cpp.
+struct CodeTable {
+#define CODE_ENUM(e, s) make_code_view(s)
+  static constexpr CodeView entries[] = {
+    #include "code_data.hpp"
+  };
+};
+
+} // namespace detail
+
+constexpr CodeView code_view(Code c) {
+  return detail::CodeTable::entries[static_cast<std::size_t>(c)];
+}
+
 char const * code_string(Code c);
 
 template <typename T>
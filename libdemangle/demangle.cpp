@@ -26,6 +26,7 @@
 #include <cstdlib>
 #include <cstring>
 #include <algorithm>
+#include <unordered_map>
 #include <boost/format.hpp>
 #include <boost/locale/encoding_utf.hpp>
 
@@ -62,7 +63,8 @@ class VisualStudioDemangler
  private:
   friend struct save_stack;
 
-  const std::string & mangled;
+  char const * mangled;
+  size_t length;
   bool debug;
   size_t offset;
   std::string error;
@@ -71,6 +73,10 @@ class VisualStudioDemangler
   ReferenceStack name_stack;
   ReferenceStack type_stack;
 
+  // The outermost symbol under construction, kept so that it can be returned when demangling
+  // fails part way through.
+  DemangledTypePtr partial;
+
   char get_next_char();
   char get_current_char();
   void advance_to_next_char();
@@ -101,6 +107,8 @@ class VisualStudioDemangler
   DemangledTypePtr & add_special_name_code(DemangledTypePtr & t);
   DemangledTypePtr & get_string(DemangledTypePtr & t);
   DemangledTypePtr get_anonymous_namespace();
+  DemangledTypePtr get_simple_class_type();
+  DemangledTypePtr get_decorated_c_name();
 
   // Get symbol always allocates a new DemangledType.
   DemangledTypePtr get_symbol();
@@ -144,8 +152,17 @@ class VisualStudioDemangler
  public:
 
   VisualStudioDemangler(const std::string & mangled, bool debug = false);
+  VisualStudioDemangler(char const * mangled, size_t length, bool debug = false);
+
+  // Start over on a new mangled name, reusing the already allocated stacks.
+  void reset(char const * mangled, size_t length);
 
   DemangledTypePtr analyze();
+  DemangledTypePtr analyze_type();
+
+  // After a failure, the offset of the error and whatever was demangled before it.
+  size_t get_offset() const { return offset; }
+  DemangledTypePtr const & get_partial() const { return partial; }
 };
 
 save_stack::save_stack(ReferenceStack & stack, VisualStudioDemangler & dm, char const * n)
@@ -176,6 +193,89 @@ inline save_stack VisualStudioDemangler::push_types()
   return save_stack(type_stack, *this, "type");
 }
 
+// A partial symbol stops wherever the error occurred, which can leave behind nodes that can't
+// be output: a pointer or reference that never got the type it points to, and a conversion
+// operator name that was never finished, whose text would be rendered from the return type
+// that contains it.  PartialPruner removes them, along with anything left incomplete by their
+// removal.
+class PartialPruner {
+ public:
+  void operator()(DemangledType & sym);
+
+ private:
+  void children(DemangledType & t, bool symbol);
+  bool prune(DemangledTypePtr const & t);
+  void prune(FullyQualifiedName & names, bool symbol_name);
+  void prune(DemangledTemplate & params);
+
+  static bool incomplete(DemangledType const & t) {
+    return !t.is_func && (t.is_pointer || t.is_reference || t.is_refref) && !t.inner_type;
+  }
+
+  // Whether each node visited should be removed.  Back-references share nodes, so this is
+  // also what keeps the walk linear.
+  std::unordered_map<DemangledType const *, bool> removed;
+};
+
+void PartialPruner::operator()(DemangledType & sym)
+{
+  removed.emplace(&sym, false);
+  children(sym, true);
+  if (incomplete(sym)) {
+    // The symbol is its own type, so it can't be removed.  Drop the pointer instead, along
+    // with the qualifiers that belonged to it.
+    sym.is_pointer = sym.is_reference = sym.is_refref = false;
+    sym.is_const = sym.is_volatile = false;
+    sym.ptr64 = 0;
+  }
+}
+
+void PartialPruner::children(DemangledType & t, bool symbol)
+{
+  // Conversion operator names are only complete as the last part of a symbol's own name
+  prune(t.name, symbol || t.symbol_type != SymbolType::Unspecified);
+  prune(t.com_interface, false);
+  prune(t.instance_name, false);
+  prune(t.args, false);
+  prune(t.template_parameters);
+  for (auto member : {&DemangledType::inner_type, &DemangledType::retval,
+                      &DemangledType::enum_real_type})
+  {
+    auto & child = t.*member;
+    if (child && prune(child)) {
+      child.reset();
+    }
+  }
+}
+
+// Returns whether t should be removed from whatever refers to it
+bool PartialPruner::prune(DemangledTypePtr const & t)
+{
+  auto found = removed.find(t.get());
+  if (found != removed.end()) {
+    return found->second;
+  }
+  removed.emplace(t.get(), false);
+  children(*t, false);
+  return removed[t.get()] = incomplete(*t);
+}
+
+void PartialPruner::prune(FullyQualifiedName & names, bool symbol_name)
+{
+  auto remove = [this, symbol_name](DemangledTypePtr const & n) {
+    return !n || (!symbol_name && n->simple_code == Code::OP_TYPE) || prune(n);
+  };
+  names.erase(std::remove_if(names.begin(), names.end(), remove), names.end());
+}
+
+void PartialPruner::prune(DemangledTemplate & params)
+{
+  auto remove = [this](DemangledTemplateParameterPtr const & p) {
+    return p && p->type && prune(p->type);
+  };
+  params.erase(std::remove_if(params.begin(), params.end(), remove), params.end());
+}
+
 } // namespace detail
 
 DemangledTypePtr visual_studio_demangle(const std::string & mangled, bool debug)
@@ -184,6 +284,77 @@ DemangledTypePtr visual_studio_demangle(const std::string & mangled, bool debug)
   return demangler.analyze();
 }
 
+DemangledTypePtr visual_studio_demangle_type(const std::string & mangled, bool debug)
+{
+  return visual_studio_demangle_type(mangled.data(), mangled.size(), debug);
+}
+
+DemangledTypePtr visual_studio_demangle_type(char const * mangled, size_t length, bool debug)
+{
+  detail::VisualStudioDemangler demangler(mangled, length, debug);
+  return demangler.analyze_type();
+}
+
+DemangleResult visual_studio_demangle_partial(const std::string & mangled, bool debug)
+{
+  detail::VisualStudioDemangler demangler(mangled, debug);
+  DemangleResult result;
+  try {
+    result.symbol = demangler.analyze();
+  } catch (Error const & e) {
+    result.symbol = demangler.get_partial();
+    if (result.symbol) {
+      detail::PartialPruner()(*result.symbol);
+    }
+    result.error = e.what();
+    result.error_offset = demangler.get_offset();
+  }
+  return result;
+}
+
+DemangledTypePtr demangle(const std::string & mangled, bool debug)
+{
+  if (is_itanium_name(mangled)) {
+    return itanium_demangle(mangled, debug);
+  }
+  return visual_studio_demangle(mangled, debug);
+}
+
+DemangleResult demangle_partial(const std::string & mangled, bool debug)
+{
+  if (is_itanium_name(mangled)) {
+    return itanium_demangle_partial(mangled, debug);
+  }
+  return visual_studio_demangle_partial(mangled, debug);
+}
+
+std::vector<DemangledTypePtr> visual_studio_demangle_types(
+  std::vector<std::string> const & mangled, std::vector<std::string> * errors, bool debug)
+{
+  std::vector<DemangledTypePtr> result;
+  result.reserve(mangled.size());
+  if (errors) {
+    errors->clear();
+    errors->resize(mangled.size());
+  }
+
+  // A single demangler is reused for the whole batch so that its stacks are only allocated
+  // once.
+  detail::VisualStudioDemangler demangler(nullptr, 0, debug);
+  for (auto & name : mangled) {
+    demangler.reset(name.data(), name.size());
+    try {
+      result.push_back(demangler.analyze_type());
+    } catch (Error const & e) {
+      if (errors) {
+        (*errors)[result.size()] = e.what();
+      }
+      result.push_back(nullptr);
+    }
+  }
+  return result;
+}
+
 std::string quote_string(const std::string & input)
 {
   static auto special_chars = "\"\\\a\b\f\n\r\t\v";
@@ -217,12 +388,29 @@ DemangledTemplateParameter::DemangledTemplateParameter(int64_t c)
   : type(nullptr), constant_value(c)
 {}
 
+constexpr uint64_t DemangledType::unbounded_dimension;
+
 namespace detail {
 
 VisualStudioDemangler::VisualStudioDemangler(const std::string & m, bool d)
-  : mangled(m), debug(d), offset(0)
+  : VisualStudioDemangler(m.data(), m.size(), d)
+{}
+
+VisualStudioDemangler::VisualStudioDemangler(char const * m, size_t l, bool d)
+  : mangled(m), length(l), debug(d), offset(0)
 {}
 
+void VisualStudioDemangler::reset(char const * m, size_t l)
+{
+  mangled = m;
+  length = l;
+  offset = 0;
+  error.clear();
+  name_stack.clear();
+  type_stack.clear();
+  partial.reset();
+}
+
 char VisualStudioDemangler::get_next_char()
 {
   // Check bounds and all that...
@@ -237,7 +425,7 @@ void VisualStudioDemangler::advance_to_next_char()
 
 char VisualStudioDemangler::get_current_char()
 {
-  if (offset >= mangled.size()) {
+  if (offset >= length) {
     general_error("Attempt to read past end of mangled string.");
   }
   return mangled[offset];
@@ -1308,8 +1496,11 @@ DemangledTypePtr VisualStudioDemangler::add_templated_type(DemangledTypePtr & ty
         {
           // We'll interpret as a $$ type, but there could be any number of $s first.  So skip
           // past the last $ and then go back two
-          auto pos = mangled.find_first_not_of('$', offset);
-          if (pos == std::string::npos) {
+          auto pos = offset;
+          while (pos < length && mangled[pos] == '$') {
+            ++pos;
+          }
+          if (pos == length) {
             bad_code(c, "template argument");
           }
           offset = pos - 2;
@@ -1450,7 +1641,7 @@ DemangledTypePtr VisualStudioDemangler::get_anonymous_namespace() {
   }
 
   // Now build the return string from the bytes we consumed.
-  std::string literal = mangled.substr(start_offset, offset - start_offset);
+  std::string literal(mangled + start_offset, offset - start_offset);
   if (debug) std::cerr << "Anonymous namespace ID was: " << literal << std::endl;
 
   // Advance past the '@' that terminated the literal.
@@ -1488,7 +1679,7 @@ std::string VisualStudioDemangler::get_literal() {
   }
 
   // Now build the return string from the bytes we consumed.
-  literal = mangled.substr(start_offset, offset - start_offset);
+  literal.assign(mangled + start_offset, offset - start_offset);
 
   if (debug) {
     std::cerr << "Extracted literal from " << start_offset << " to " << offset
@@ -1618,7 +1809,11 @@ DemangledTypePtr VisualStudioDemangler::get_symbol() {
   get_symbol_start();
 
   auto t = std::make_shared<DemangledType>();
+  bool outermost = !partial;
+  if (outermost) partial = t;
   get_fully_qualified_name(t, false);
+  // Constant strings replace the symbol while reading the name.
+  if (outermost) partial = t;
   if (t->symbol_type == SymbolType::Unspecified) {
     get_symbol_type(t);
   }
@@ -1688,18 +1883,109 @@ DemangledTypePtr VisualStudioDemangler::get_symbol() {
 }
 
 
+// Decorated C names: "_name" (__cdecl, but variables are decorated the same way), "_name@N"
+// (__stdcall) and "@name@N" (__fastcall), where N is the number of bytes of arguments in
+// decimal.  The number of bytes is stored in n[0].  The names of imports on 64-bit platforms
+// are not decorated at all, so when following an __imp_ prefix anything else is taken as a
+// plain name.
+DemangledTypePtr VisualStudioDemangler::get_decorated_c_name() {
+  progress("decorated C name");
+  auto t = partial = std::make_shared<DemangledType>();
+  t->symbol_type = SymbolType::DecoratedC;
+  t->extern_c = true;
+
+  char c = get_current_char();
+  bool fastcall = (c == '@');
+  if (c == '_' || c == '@') {
+    advance_to_next_char();
+  }
+
+  // The name must be a C identifier, although MSVC also allows '$' in them.
+  auto is_name_char = [](char ch) {
+    return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9')
+      || ch == '_' || ch == '$';
+  };
+  size_t start = offset;
+  while (offset < length && is_name_char(mangled[offset])) {
+    ++offset;
+  }
+  if (offset == start) {
+    general_error("Expected a name in decorated C name.");
+  }
+  if (mangled[start] >= '0' && mangled[start] <= '9') {
+    general_error("Decorated C name starts with a digit.");
+  }
+  if (offset < length && mangled[offset] != '@') {
+    general_error(boost::str(
+      boost::format("Unexpected character '%c' in decorated C name at offset %d")
+      % mangled[offset] % offset));
+  }
+  t->add_name(std::string(mangled + start, offset - start));
+
+  if (offset == length) {
+    if (fastcall) {
+      general_error("Expected '@' followed by the argument size in __fastcall name.");
+    }
+    return t;
+  }
+
+  // Advance past the '@' that precedes the argument size.
+  advance_to_next_char();
+  progress("decorated C argument size");
+  size_t digits = 0;
+  int64_t bytes = 0;
+  for (; offset < length && mangled[offset] >= '0' && mangled[offset] <= '9'; ++offset) {
+    if (++digits > 10) {
+      general_error("There were too many digits in the argument size of a decorated C name.");
+    }
+    bytes = bytes * 10 + (mangled[offset] - '0');
+  }
+  if (digits == 0 || offset != length) {
+    general_error("Expected a decimal argument size at the end of decorated C name.");
+  }
+
+  t->is_func = true;
+  t->calling_convention = fastcall ? "__fastcall" : "__stdcall";
+  t->n.push_back(bytes);
+  return t;
+}
+
 // Not part of the constructor because it throws.
 DemangledTypePtr VisualStudioDemangler::analyze() {
 
+  // Import address table entries for both C++ and C symbols.
+  static char const import_prefix[] = "__imp_";
+  static size_t const import_length = sizeof(import_prefix) - 1;
+  if (length - offset >= import_length
+      && std::memcmp(mangled + offset, import_prefix, import_length) == 0)
+  {
+    progress("import prefix");
+    offset += import_length;
+    if (offset == length) {
+      general_error("Expected a symbol after the import prefix.");
+    }
+    if (length - offset >= import_length
+        && std::memcmp(mangled + offset, import_prefix, import_length) == 0)
+    {
+      general_error("An import prefix can't be imported again.");
+    }
+    char c = get_current_char();
+    auto t = (c == '?' || c == '.' || c == '_' || c == '@') ? analyze() : get_decorated_c_name();
+    t->is_imported = true;
+    return t;
+  }
+
   char c = get_current_char();
-  if (c == '_') {
-    general_error("Mangled names beginning with '_' are currently not supported.");
-    throw Error(error);
+  if (c == '_' || c == '@') {
+    return get_decorated_c_name();
   }
   else if (c == '.') {
     advance_to_next_char();
+    if (auto t = get_simple_class_type()) {
+      return t;
+    }
     // Why there's a return type for RTTI descriptor is a little unclear to me...
-    auto t = std::make_shared<DemangledType>();
+    auto t = partial = std::make_shared<DemangledType>();
     get_return_type(t);
     return t;
   }
@@ -1708,6 +1994,82 @@ DemangledTypePtr VisualStudioDemangler::analyze() {
   }
 }
 
+// RTTI type descriptor names are just a type, optionally preceded by a '.'.  Unlike analyze(),
+// the entire name must be consumed.
+DemangledTypePtr VisualStudioDemangler::analyze_type() {
+  if (get_current_char() == '.') {
+    advance_to_next_char();
+  }
+  auto t = get_simple_class_type();
+  if (!t) {
+    t = partial = std::make_shared<DemangledType>();
+    get_return_type(t);
+  }
+  if (offset != length) {
+    error = boost::str(boost::format("Unexpected character '%c' after type at offset %d")
+                       % mangled[offset] % offset);
+    throw Error(error);
+  }
+  return t;
+}
+
+// The vast majority of type descriptors are for plain (non-templated) classes and structs,
+// such as ".?AVFoo@ns@@".  These can be built directly without going through the general
+// parser, which would push every name onto the name stack for references that can never
+// occur.  Returns null without consuming anything if the type isn't of this simple form.
+DemangledTypePtr VisualStudioDemangler::get_simple_class_type() {
+  if (length - offset < 5 || mangled[offset] != '?' || mangled[offset + 1] != 'A') {
+    return DemangledTypePtr();
+  }
+  Code code;
+  switch (mangled[offset + 2]) {
+   case 'T': code = Code::UNION; break;
+   case 'U': code = Code::STRUCT; break;
+   case 'V': code = Code::CLASS; break;
+   default:
+    return DemangledTypePtr();
+  }
+
+  // Validate the fully qualified name before allocating anything.  Each term must be a
+  // non-empty literal (not a reference or special name), and the name ends with "@@".
+  size_t pos = offset + 3;
+  size_t terms = 0;
+  while (true) {
+    size_t start = pos;
+    for (; pos < length && mangled[pos] != '@'; ++pos) {
+      char c = mangled[pos];
+      if (!((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z')
+            || (c >= '0' && c <= '9' && pos != start)
+            || c == '_' || c == '$' || c == '<' || c == '>' || c == '-' || c == '.'))
+      {
+        return DemangledTypePtr();
+      }
+    }
+    if (pos == length || pos == start) {
+      return DemangledTypePtr();
+    }
+    ++terms;
+    if (++pos < length && mangled[pos] == '@') {
+      ++pos;
+      break;
+    }
+  }
+
+  progress("simple class type");
+  auto t = std::make_shared<DemangledType>(code);
+  t->name.reserve(terms);
+  size_t start = offset + 3;
+  for (size_t i = start; i < pos - 1; ++i) {
+    if (mangled[i] == '@') {
+      t->name.push_back(
+        std::make_shared<DemangledType>(std::string(mangled + start, i - start)));
+      start = i + 1;
+    }
+  }
+  offset = pos;
+  return t;
+}
+
 } // namespace detail
 } // namespace demangle
 
@@ -50,7 +50,8 @@ enum class SymbolType {
   VtorDisp,
   StaticGuard,
   MethodThunk,
-  HexSymbol
+  HexSymbol,
+  DecoratedC
 };
 
 enum class Scope {
@@ -123,8 +124,9 @@ class DemangledType {
   bool is_pointer = false;
   bool is_array = false;
 
-  // Array dimensions
+  // Array dimensions.  An array of unknown bound has an unbounded_dimension.
   std::vector<uint64_t> dimensions;
+  static constexpr uint64_t unbounded_dimension = ~uint64_t(0);
 
   // Hacky thing for complex types that can't get rendered any better than putting them inside
   // a pair of single quotes.  e.g. ?X@??Y@@9@9 demangles to "`Y'::X".  The extra quotes aren't
@@ -139,7 +141,8 @@ class DemangledType {
   bool is_member = false;
 
   // True if the namespace is anonymous.  The simple_type string then contains the unique
-  // identifier name that's not typically shown for anonymous namespaces.
+  // identifier name that's not typically shown for anonymous namespaces (empty when the
+  // mangling has no such identifier).
   bool is_anonymous = false;
 
   // This is handled horribly by Microsoft, and equally horribly by me.  I want to think some
@@ -219,6 +222,22 @@ class DemangledType {
   // extern "C" (which shouldn't be mangled, but Microsoft)
   bool extern_c = false;
 
+  // The symbol was prefixed with __imp_, making it the import address table entry for the
+  // symbol rather than the symbol itself.
+  bool is_imported = false;
+
+  // Itanium transactional memory clones of a function (_ZGTt and _ZGTn)
+  bool transaction_clone = false;
+  bool non_transaction_clone = false;
+
+  // Itanium ABI tags on a name, such as "cxx11" for failure[abi:cxx11].  The name of a
+  // constructor or destructor doesn't repeat the tags of its class.
+  std::vector<std::string> abi_tags;
+
+  // The vendor suffixes of a compiler generated clone of an Itanium symbol, such as ".isra.0"
+  // and ".cold" for foo() [clone .isra.0] [clone .cold].
+  std::vector<std::string> clones;
+
   DemangledType() = default;
   DemangledType(const DemangledType & other) = default;
   DemangledType(DemangledType && other) = default;
@@ -241,6 +260,54 @@ class DemangledType {
 // Main entry point to demangler
 DemangledTypePtr visual_studio_demangle(const std::string & mangled, bool debug = false);
 
+// The result of visual_studio_demangle_partial().
+struct DemangleResult {
+  // The demangled symbol.  If demangling failed, this is whatever had been parsed before the
+  // error occurred (or null if nothing had been).  Such a partial symbol is missing anything
+  // after the error, along with any pointer or name that the error left unfinished, but any
+  // fully qualified name that preceded it will be intact.
+  DemangledTypePtr symbol;
+
+  // The error message, or empty if demangling succeeded.
+  std::string error;
+
+  // The offset into the mangled name at which the error occurred.
+  std::size_t error_offset = 0;
+
+  bool ok() const { return error.empty(); }
+};
+
+// Like visual_studio_demangle(), but rather than throwing an Error and discarding the symbol
+// on failure, returns the error along with the partially demangled symbol.
+DemangleResult visual_studio_demangle_partial(const std::string & mangled, bool debug = false);
+
+// Demangle an RTTI type descriptor name (the name stored in a TypeDescriptor), such as
+// ".?AVFoo@@", returning just the type.  The leading '.' is optional.  The pointer and length
+// form allows names to be demangled in place, without copying them into a string first.
+DemangledTypePtr visual_studio_demangle_type(const std::string & mangled, bool debug = false);
+DemangledTypePtr visual_studio_demangle_type(char const * mangled, std::size_t length,
+                                             bool debug = false);
+
+// Batch form of visual_studio_demangle_type().  Names that fail to demangle produce a null
+// pointer at the corresponding position in the result.  If errors is non-null, it is filled
+// with the error message for each failed name (and an empty string for each successful one).
+std::vector<DemangledTypePtr> visual_studio_demangle_types(
+  std::vector<std::string> const & mangled, std::vector<std::string> * errors = nullptr,
+  bool debug = false);
+
+// Demangle an Itanium C++ ABI name (as produced by GCC, Clang and MinGW), such as
+// "_ZN2ns3fooEi".  The extra leading underscore added on some platforms and an "__imp_" prefix
+// are both accepted.
+DemangledTypePtr itanium_demangle(const std::string & mangled, bool debug = false);
+DemangleResult itanium_demangle_partial(const std::string & mangled, bool debug = false);
+
+// Returns true if the name is an Itanium C++ ABI name rather than a Visual Studio one.
+bool is_itanium_name(const std::string & mangled);
+
+// Demangle a name using whichever of the demanglers above matches its form.
+DemangledTypePtr demangle(const std::string & mangled, bool debug = false);
+DemangleResult demangle_partial(const std::string & mangled, bool debug = false);
+
 } // namespace demangle
 
 #endif // Include_Demangle_H
@@ -0,0 +1,620 @@
+// Pharos Demangler
+//
+// Copyright 2017 Carnegie Mellon University. All Rights Reserved.
+//
+// NO WARRANTY. THIS CARNEGIE MELLON UNIVERSITY AND SOFTWARE ENGINEERING
+// INSTITUTE MATERIAL IS FURNISHED ON AN "AS-IS" BASIS. CARNEGIE MELLON
+// UNIVERSITY MAKES NO WARRANTIES OF ANY KIND, EITHER EXPRESSED OR
+// IMPLIED, AS TO ANY MATTER INCLUDING, BUT NOT LIMITED TO, WARRANTY OF
+// FITNESS FOR PURPOSE OR MERCHANTABILITY, EXCLUSIVITY, OR RESULTS
+// OBTAINED FROM USE OF THE MATERIAL. CARNEGIE MELLON UNIVERSITY DOES NOT
+// MAKE ANY WARRANTY OF ANY KIND WITH RESPECT TO FREEDOM FROM PATENT,
+// TRADEMARK, OR COPYRIGHT INFRINGEMENT.
+//
+// Released under a BSD-style license, please see license.txt or contact
+// permission@sei.cmu.edu for full terms.
+//
+// [DISTRIBUTION STATEMENT A] This material has been approved for public
+// release and unlimited distribution.  Please see Copyright notice for
+// non-US Government use and distribution.
+//
+// DM17-0949
+
+#include "demangle_binary.hpp"
+#include <algorithm>            // std::max
+#include <cstring>              // std::memcmp
+#include <unordered_map>        // std::unordered_map
+
+namespace demangle {
+
+namespace {
+
+char const magic[] = {'P', 'D', 'M', 'B'};
+
+// The bits of the fields varint (see BinaryWriter), with the most common in the first byte
+enum : unsigned {
+  F_FLAGS = 1u << 0,
+  F_SIMPLE_STRING = 1u << 1,
+  F_SIMPLE_CODE = 1u << 2,
+  F_NAME = 1u << 3,
+  F_TEMPLATE_PARAMETERS = 1u << 4,
+  F_ENUMS = 1u << 5,
+  F_INNER_TYPE = 1u << 6,
+  F_CALLING_CONVENTION = 1u << 7,
+  F_RETVAL = 1u << 8,
+  F_ARGS = 1u << 9,
+  F_PTR64 = 1u << 10,
+  F_DIMENSIONS = 1u << 11,
+  F_ENUM_REAL_TYPE = 1u << 12,
+  F_COM_INTERFACE = 1u << 13,
+  F_INSTANCE_NAME = 1u << 14,
+  F_N = 1u << 15,
+  F_ABI_TAGS = 1u << 16,
+  F_CLONES = 1u << 17,
+  F_ALL = (1u << 18) - 1
+};
+
+using detail::boolean_members;
+
+} // unnamed namespace
+
+namespace detail {
+
+bool DemangledType::* const boolean_members[boolean_member_count] = {
+  &DemangledType::is_const, &DemangledType::is_volatile, &DemangledType::is_reference,
+  &DemangledType::is_pointer, &DemangledType::is_array, &DemangledType::is_embedded,
+  &DemangledType::is_func, &DemangledType::is_based, &DemangledType::is_member,
+  &DemangledType::is_anonymous, &DemangledType::is_refref, &DemangledType::unaligned,
+  &DemangledType::restrict, &DemangledType::is_gc, &DemangledType::is_pin,
+  &DemangledType::is_exported, &DemangledType::is_ctor, &DemangledType::is_dtor,
+  &DemangledType::extern_c, &DemangledType::is_imported, &DemangledType::transaction_clone,
+  &DemangledType::non_transaction_clone
+};
+
+char const * incomplete_type(DemangledType const & t)
+{
+  if (!t.is_func && (t.is_pointer || t.is_reference || t.is_refref) && !t.inner_type) {
+    return "Missing pointed to type";
+  }
+  if (t.symbol_type == SymbolType::String
+      && (!t.inner_type || t.name.empty() || t.n.empty()))
+  {
+    return "Incomplete string constant";
+  }
+  return nullptr;
+}
+
+namespace {
+
+// Finds why a reader couldn't load a symbol.  Each type is checked once, and remembers the
+// number of types on the longest path down from it, since a reader reaching it deeper might
+// then nest too deeply.
+class LoadCheck {
+ public:
+  explicit LoadCheck(unsigned max_depth) : max_depth_(max_depth) {}
+
+  char const * operator()(DemangledType const & sym) {
+    height(&sym, 0);
+    return why_;
+  }
+
+ private:
+  unsigned height(DemangledType const * t, unsigned depth) {
+    if (!t || why_) {
+      return 0;
+    }
+    auto found = heights_.find(t);
+    if (found != heights_.end()) {
+      if (depth + found->second > max_depth_) {
+        why_ = "Types nested too deeply";
+      }
+      return found->second;
+    }
+    if (depth == max_depth_) {
+      why_ = "Types nested too deeply";
+      return 0;
+    }
+    why_ = incomplete_type(*t);
+    unsigned h = 0;
+    auto child = [this, depth, &h](DemangledType const * c) {
+      h = std::max(h, height(c, depth + 1));
+    };
+    auto names = [&child](FullyQualifiedName const & list) {
+      for (auto & n : list) {
+        child(n.get());
+      }
+    };
+    for (auto & p : t->template_parameters) {
+      if (p) {
+        child(p->type.get());
+      }
+    }
+    names(t->name);
+    names(t->args);
+    names(t->com_interface);
+    names(t->instance_name);
+    child(t->inner_type.get());
+    child(t->retval.get());
+    child(t->enum_real_type.get());
+    heights_.emplace(t, h + 1);
+    return h + 1;
+  }
+
+  unsigned max_depth_;
+  char const * why_ = nullptr;
+  std::unordered_map<DemangledType const *, unsigned> heights_;
+};
+
+} // unnamed namespace
+
+char const * unloadable_symbol(DemangledType const & sym, unsigned max_depth)
+{
+  return LoadCheck(max_depth)(sym);
+}
+
+} // namespace detail
+
+constexpr unsigned char BinaryWriter::version;
+constexpr unsigned BinaryReader::max_depth;
+
+void BinaryWriter::header()
+{
+  out_.append(magic, sizeof(magic));
+  out_ += char(version);
+}
+
+void BinaryWriter::record(std::string const & mangled, DemangledType const & sym)
+{
+  auto why = detail::unloadable_symbol(sym, BinaryReader::max_depth);
+  if (why) {
+    throw Error(std::string("Symbol can't be written: ") + why);
+  }
+  begin_record(mangled);
+  uinteger(0);
+  type(&sym);
+  end_record();
+}
+
+void BinaryWriter::record(std::string const & mangled, DemangleResult const & result)
+{
+  begin_record(mangled);
+  uinteger(1);
+  string(result.error);
+  uinteger(result.error_offset);
+  auto partial = result.symbol.get();
+  if (partial && detail::unloadable_symbol(*partial, BinaryReader::max_depth)) {
+    partial = nullptr;
+  }
+  type(partial);
+  end_record();
+}
+
+void BinaryWriter::begin_record(std::string const & mangled)
+{
+  start_ = out_.size();
+  nodes_.clear();
+  strings_.clear();
+  string(mangled);
+}
+
+void BinaryWriter::end_record()
+{
+  // The length isn't known until the record is written, so it goes in front afterwards
+  char buf[10];
+  std::size_t n = 0;
+  auto v = out_.size() - start_;
+  do {
+    buf[n++] = char((v & 0x7f) | (v > 0x7f ? 0x80 : 0));
+    v >>= 7;
+  } while (v);
+  out_.insert(start_, buf, n);
+}
+
+void BinaryWriter::uinteger(std::uint64_t v)
+{
+  while (v > 0x7f) {
+    out_ += char((v & 0x7f) | 0x80);
+    v >>= 7;
+  }
+  out_ += char(v);
+}
+
+void BinaryWriter::integer(std::int64_t v)
+{
+  uinteger((std::uint64_t(v) << 1) ^ (v < 0 ? ~std::uint64_t(0) : 0));
+}
+
+void BinaryWriter::string(std::string const & s)
+{
+  auto found = strings_.find(s);
+  if (found != strings_.end()) {
+    uinteger(2 * found->second + 1);
+    return;
+  }
+  strings_.emplace(s, strings_.size());
+  uinteger(2 * std::uint64_t(s.size()));
+  out_ += s;
+}
+
+void BinaryWriter::strings(std::vector<std::string> const & strings)
+{
+  uinteger(strings.size());
+  for (auto & s : strings) {
+    string(s);
+  }
+}
+
+void BinaryWriter::type(DemangledType const * t)
+{
+  if (!t) {
+    uinteger(0);
+    return;
+  }
+  auto found = nodes_.find(t);
+  if (found != nodes_.end()) {
+    uinteger(found->second + 2);
+    return;
+  }
+  uinteger(1);
+  node(*t);
+  nodes_.emplace(t, nodes_.size());
+}
+
+void BinaryWriter::names(FullyQualifiedName const & names)
+{
+  uinteger(names.size());
+  for (auto & n : names) {
+    type(n.get());
+  }
+}
+
+void BinaryWriter::node(DemangledType const & t)
+{
+  std::uint64_t bools = 0;
+  for (std::size_t i = 0; i < detail::boolean_member_count; ++i) {
+    if (t.*boolean_members[i]) {
+      bools |= std::uint64_t(1) << i;
+    }
+  }
+  unsigned fields = 0;
+  auto enums = std::uint64_t(t.symbol_type) | std::uint64_t(t.distance) << 4
+               | std::uint64_t(t.scope) << 6 | std::uint64_t(t.method_property) << 8;
+  auto has = [&fields](bool cond, unsigned bit) {
+    if (cond) {
+      fields |= bit;
+    }
+  };
+  has(bools, F_FLAGS);
+  has(enums, F_ENUMS);
+  has(t.ptr64, F_PTR64);
+  has(t.simple_code != Code::UNDEFINED, F_SIMPLE_CODE);
+  has(!t.simple_string.empty(), F_SIMPLE_STRING);
+  has(!t.dimensions.empty(), F_DIMENSIONS);
+  has(bool(t.inner_type), F_INNER_TYPE);
+  has(bool(t.enum_real_type), F_ENUM_REAL_TYPE);
+  has(!t.name.empty(), F_NAME);
+  has(!t.com_interface.empty(), F_COM_INTERFACE);
+  has(!t.template_parameters.empty(), F_TEMPLATE_PARAMETERS);
+  has(!t.calling_convention.empty(), F_CALLING_CONVENTION);
+  has(!t.instance_name.empty(), F_INSTANCE_NAME);
+  has(bool(t.retval), F_RETVAL);
+  has(!t.args.empty(), F_ARGS);
+  has(!t.n.empty(), F_N);
+  has(!t.abi_tags.empty(), F_ABI_TAGS);
+  has(!t.clones.empty(), F_CLONES);
+  uinteger(fields);
+
+  if (fields & F_FLAGS) uinteger(bools);
+  if (fields & F_SIMPLE_STRING) string(t.simple_string);
+  if (fields & F_SIMPLE_CODE) uinteger(static_cast<unsigned>(t.simple_code));
+  if (fields & F_NAME) names(t.name);
+  if (fields & F_TEMPLATE_PARAMETERS) {
+    uinteger(t.template_parameters.size());
+    for (auto & p : t.template_parameters) {
+      if (!p) {
+        uinteger(0);
+      } else if (p->type) {
+        uinteger(2 + (p->pointer << 1));
+        type(p->type.get());
+      } else {
+        uinteger(1 + (p->pointer << 1));
+        integer(p->constant_value);
+      }
+    }
+  }
+  if (fields & F_ENUMS) uinteger(enums);
+  if (fields & F_INNER_TYPE) type(t.inner_type.get());
+  if (fields & F_CALLING_CONVENTION) string(t.calling_convention);
+  if (fields & F_RETVAL) type(t.retval.get());
+  if (fields & F_ARGS) names(t.args);
+  if (fields & F_PTR64) integer(t.ptr64);
+  if (fields & F_DIMENSIONS) {
+    uinteger(t.dimensions.size());
+    for (auto d : t.dimensions) {
+      uinteger(d);
+    }
+  }
+  if (fields & F_ENUM_REAL_TYPE) type(t.enum_real_type.get());
+  if (fields & F_COM_INTERFACE) names(t.com_interface);
+  if (fields & F_INSTANCE_NAME) names(t.instance_name);
+  if (fields & F_N) {
+    uinteger(t.n.size());
+    for (auto v : t.n) {
+      integer(v);
+    }
+  }
+  if (fields & F_ABI_TAGS) strings(t.abi_tags);
+  if (fields & F_CLONES) strings(t.clones);
+}
+
+[[noreturn]] void BinaryReader::fail(char const * what) const
+{
+  throw Error(std::string(what) + " in binary data at offset "
+              + std::to_string(p_ - data_));
+}
+
+void BinaryReader::header()
+{
+  if (remaining() < sizeof(magic) + 1 || std::memcmp(p_, magic, sizeof(magic)) != 0) {
+    fail("Missing header");
+  }
+  p_ += sizeof(magic);
+  if (byte() != BinaryWriter::version) {
+    fail("Unsupported version");
+  }
+}
+
+bool BinaryReader::next(BinaryRecord & record)
+{
+  if (p_ == end_) {
+    return false;
+  }
+  auto length = uinteger();
+  if (length > remaining()) {
+    fail("Truncated record");
+  }
+  // Stay in the record, and if it is bad, skip it so that the next can still be read
+  auto end = p_ + length;
+  auto saved = end_;
+  end_ = end;
+  try {
+    read_record(record);
+  } catch (Error const &) {
+    p_ = end;
+    end_ = saved;
+    depth_ = 0;
+    partial_ = false;
+    throw;
+  }
+  end_ = saved;
+  return true;
+}
+
+void BinaryReader::read_record(BinaryRecord & record)
+{
+  nodes_.clear();
+  strings_.clear();
+  record.symbol = string();
+  record.result = DemangleResult();
+  switch (uinteger()) {
+   case 0:
+    record.result.symbol = type();
+    if (!record.result.symbol) {
+      fail("Missing symbol");
+    }
+    break;
+   case 1:
+    record.result.error = string();
+    record.result.error_offset = std::size_t(uinteger());
+    partial_ = true;
+    incomplete_ = false;
+    record.result.symbol = type();
+    partial_ = false;
+    if (incomplete_) {
+      record.result.symbol.reset();
+    }
+    break;
+   default:
+    fail("Invalid record status");
+  }
+  if (p_ != end_) {
+    fail("Unexpected data at end of record");
+  }
+}
+
+unsigned char BinaryReader::byte()
+{
+  if (p_ == end_) {
+    fail("Unexpected end of data");
+  }
+  return static_cast<unsigned char>(*p_++);
+}
+
+std::uint64_t BinaryReader::uinteger()
+{
+  std::uint64_t v = 0;
+  for (unsigned shift = 0; shift < 64; shift += 7) {
+    auto b = byte();
+    v |= std::uint64_t(b & 0x7f) << shift;
+    if (!(b & 0x80)) {
+      return v;
+    }
+  }
+  fail("Invalid integer");
+}
+
+std::int64_t BinaryReader::integer()
+{
+  auto v = uinteger();
+  return std::int64_t((v >> 1) ^ (~(v & 1) + 1));
+}
+
+// A count of items that each take at least one byte, so a count that is too large to be right
+// is caught before anything is allocated for it
+std::size_t BinaryReader::count()
+{
+  auto n = uinteger();
+  if (n > remaining()) {
+    fail("Invalid count");
+  }
+  return std::size_t(n);
+}
+
+std::string BinaryReader::string()
+{
+  auto k = uinteger();
+  if (k & 1) {
+    if (k / 2 >= strings_.size()) {
+      fail("Invalid string reference");
+    }
+    return strings_[std::size_t(k / 2)];
+  }
+  if (k / 2 > remaining()) {
+    fail("Truncated string");
+  }
+  auto n = std::size_t(k / 2);
+  strings_.emplace_back(p_, n);
+  p_ += n;
+  return strings_.back();
+}
+
+void BinaryReader::strings(std::vector<std::string> & strings)
+{
+  strings.resize(count());
+  for (auto & s : strings) {
+    s = string();
+  }
+}
+
+DemangledTypePtr BinaryReader::type()
+{
+  auto r = uinteger();
+  if (r == 0) {
+    return nullptr;
+  }
+  if (r > 1) {
+    if (r - 2 >= nodes_.size()) {
+      fail("Invalid type reference");
+    }
+    return nodes_[std::size_t(r - 2)];
+  }
+  if (depth_ == max_depth) {
+    fail("Types nested too deeply");
+  }
+  ++depth_;
+  auto t = std::make_shared<DemangledType>();
+  node(*t);
+  auto incomplete = detail::incomplete_type(*t);
+  if (incomplete) {
+    if (!partial_) {
+      fail(incomplete);
+    }
+    incomplete_ = true;
+  }
+  --depth_;
+  nodes_.push_back(t);
+  return t;
+}
+
+void BinaryReader::names(FullyQualifiedName & names)
+{
+  auto n = count();
+  names.reserve(n);
+  for (std::size_t i = 0; i < n; ++i) {
+    auto t = type();
+    if (!t) {
+      fail("Missing name");
+    }
+    names.push_back(std::move(t));
+  }
+}
+
+void BinaryReader::node(DemangledType & t)
+{
+  auto fields = uinteger();
+  if (fields & ~std::uint64_t(F_ALL)) {
+    fail("Invalid fields");
+  }
+  if (fields & F_FLAGS) {
+    auto bools = uinteger();
+    if (bools >> detail::boolean_member_count) {
+      fail("Invalid flags");
+    }
+    for (std::size_t i = 0; i < detail::boolean_member_count; ++i) {
+      t.*boolean_members[i] = bools & (std::uint64_t(1) << i);
+    }
+  }
+  if (fields & F_SIMPLE_STRING) t.simple_string = string();
+  if (fields & F_SIMPLE_CODE) {
+    auto code = uinteger();
+    if (code >= detail::code_count) {
+      fail("Invalid code");
+    }
+    t.simple_code = Code(code);
+  }
+  if (fields & F_NAME) names(t.name);
+  if (fields & F_TEMPLATE_PARAMETERS) {
+    auto n = count();
+    t.template_parameters.reserve(n);
+    for (std::size_t i = 0; i < n; ++i) {
+      auto kind = uinteger();
+      DemangledTemplateParameterPtr p;
+      if (kind == 1 || kind == 3) {
+        p = std::make_shared<DemangledTemplateParameter>(integer());
+      } else if (kind == 2 || kind == 4) {
+        p = std::make_shared<DemangledTemplateParameter>(type());
+        if (!p->type) {
+          fail("Missing template parameter type");
+        }
+      } else if (kind != 0) {
+        fail("Invalid template parameter");
+      }
+      if (p) {
+        p->pointer = kind > 2;
+      }
+      t.template_parameters.push_back(std::move(p));
+    }
+  }
+  if (fields & F_ENUMS) {
+    auto enums = uinteger();
+    if ((enums & 0xf) > unsigned(SymbolType::DecoratedC)
+        || ((enums >> 8) & 0x7) > unsigned(MethodProperty::Thunk) || enums >> 11)
+    {
+      fail("Invalid symbol properties");
+    }
+    t.symbol_type = SymbolType(enums & 0xf);
+    t.distance = Distance((enums >> 4) & 0x3);
+    t.scope = Scope((enums >> 6) & 0x3);
+    t.method_property = MethodProperty((enums >> 8) & 0x7);
+  }
+  if (fields & F_INNER_TYPE) t.inner_type = type();
+  if (fields & F_CALLING_CONVENTION) t.calling_convention = string();
+  if (fields & F_RETVAL) t.retval = type();
+  if (fields & F_ARGS) names(t.args);
+  if (fields & F_PTR64) t.ptr64 = int(integer());
+  if (fields & F_DIMENSIONS) {
+    t.dimensions.resize(count());
+    for (auto & d : t.dimensions) {
+      d = uinteger();
+    }
+  }
+  if (fields & F_ENUM_REAL_TYPE) t.enum_real_type = type();
+  if (fields & F_COM_INTERFACE) names(t.com_interface);
+  if (fields & F_INSTANCE_NAME) names(t.instance_name);
+  if (fields & F_N) {
+    t.n.resize(count());
+    for (auto & v : t.n) {
+      v = integer();
+    }
+  }
+  if (fields & F_ABI_TAGS) strings(t.abi_tags);
+  if (fields & F_CLONES) strings(t.clones);
+}
+
+} // namespace demangle
+
+/* Local Variables:   */
+/* mode: c++          */
+/* fill-column:    95 */
+/* comment-column: 0  */
+/* End:               */
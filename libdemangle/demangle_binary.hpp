@@ -0,0 +1,208 @@
+// Pharos Demangler
+//
+// Copyright 2017-2020 Carnegie Mellon University. All Rights Reserved.
+//
+// NO WARRANTY. THIS CARNEGIE MELLON UNIVERSITY AND SOFTWARE ENGINEERING
+// INSTITUTE MATERIAL IS FURNISHED ON AN "AS-IS" BASIS. CARNEGIE MELLON
+// UNIVERSITY MAKES NO WARRANTIES OF ANY KIND, EITHER EXPRESSED OR
+// IMPLIED, AS TO ANY MATTER INCLUDING, BUT NOT LIMITED TO, WARRANTY OF
+// FITNESS FOR PURPOSE OR MERCHANTABILITY, EXCLUSIVITY, OR RESULTS
+// OBTAINED FROM USE OF THE MATERIAL. CARNEGIE MELLON UNIVERSITY DOES NOT
+// MAKE ANY WARRANTY OF ANY KIND WITH RESPECT TO FREEDOM FROM PATENT,
+// TRADEMARK, OR COPYRIGHT INFRINGEMENT.
+//
+// Released under a BSD-style license, please see license.txt or contact
+// permission@sei.cmu.edu for full terms.
+//
+// [DISTRIBUTION STATEMENT A] This material has been approved for public
+// release and unlimited distribution.  Please see Copyright notice for
+// non-US Government use and distribution.
+//
+// DM17-0949
+
+
+#ifndef Include_demangle_binary
+#define Include_demangle_binary
+
+#include "demangle.hpp"
+
+#include <string>               // std::string
+#include <vector>               // std::vector
+#include <unordered_map>        // std::unordered_map
+#include <cstdint>              // std::uint64_t, std::int64_t
+#include <type_traits>          // std::extent
+
+namespace demangle {
+
+namespace detail {
+
+// The boolean members of DemangledType, in the order of their bits in the binary encoding and
+// the symbol store
+constexpr std::size_t boolean_member_count = 22;
+extern bool DemangledType::* const boolean_members[boolean_member_count];
+
+// The number of values of Code
+constexpr std::size_t code_count = std::extent<decltype(CodeTable::entries)>::value;
+
+// Why a type that has been read back can't be output, or nullptr if it can.  These are the
+// members that the demangler always fills in, and so the text and JSON output rely on.
+char const * incomplete_type(DemangledType const & t);
+
+// Why a reader that nests types at most max_depth deep couldn't load a symbol, or nullptr if
+// it could.  Every type must pass incomplete_type().  The writers reject such a symbol, and
+// drop such a partial symbol.
+char const * unloadable_symbol(DemangledType const & sym, unsigned max_depth);
+
+} // namespace detail
+
+// A compact binary encoding of demangled symbols, so that another process can rebuild the
+// DemangledType trees without rendering and parsing them as JSON.
+//
+// A stream is the header, "PDMB" followed by the version byte (1), and then any number of
+// records.  All integers are LEB128 varints (seven bits per byte, least significant first,
+// with the top bit set on all but the last byte), and signed ones are zigzag encoded first.
+// A string is a varint k, which is 2 * length followed by the bytes for a string not yet seen
+// in the record, or 2 * i + 1 for the i-th distinct string of the record.
+//
+//   record  := length symbol status
+//   status  := 0 type                          demangled
+//            | 1 error offset type             failed, with the partial symbol (or null)
+//   type    := 0                               null
+//            | 1 node                          a new node
+//            | i + 2                           the i-th node of the record
+//   node    := fields [values...]
+//
+// The length is that of the rest of the record, so that a reader can skip records.  Nodes are
+// numbered in the order that they are completed, after their children, so a reference is
+// always to a finished node, and shared nodes (from back-references in the mangled name) are
+// written once and stay shared when read.  The fields varint says which members of the
+// DemangledType have values that follow, in this order, and members with their default values
+// are left out:
+//
+//   0   flags: a varint of the boolean members, bit 0 for is_const, then is_volatile,
+//       is_reference, is_pointer, is_array, is_embedded, is_func, is_based, is_member,
+//       is_anonymous, is_refref, unaligned, restrict, is_gc, is_pin, is_exported, is_ctor,
+//       is_dtor, extern_c, is_imported, transaction_clone, and non_transaction_clone
+//   1   simple_string
+//   2   simple_code, as the value of the Code
+//   3   name: count, then each type
+//   4   template_parameters: count, then each parameter
+//   5   symbol_type | distance << 4 | scope << 6 | method_property << 8
+//   6   inner_type
+//   7   calling_convention
+//   8   retval
+//   9   args: count, then each type
+//   10  ptr64 (signed)
+//   11  dimensions: count, then each
+//   12  enum_real_type
+//   13  com_interface: count, then each type
+//   14  instance_name: count, then each type
+//   15  n: count, then each (signed)
+//   16  abi_tags: count, then each string
+//   17  clones: count, then each string
+//
+// A template parameter is 0 when null, 1 + (pointer << 1) followed by the signed constant
+// value when it has no type, or 2 + (pointer << 1) followed by the type.  The values of Code
+// are those of this version of the library.
+class BinaryWriter {
+ public:
+  // Appends to out
+  explicit BinaryWriter(std::string & out) : out_(out) {}
+
+  static constexpr unsigned char version = 1;
+
+  // Write the stream header
+  void header();
+
+  // Write the record of a symbol that demangled, throwing an Error if a BinaryReader couldn't
+  // read it back (see detail::unloadable_symbol())
+  void record(std::string const & mangled, DemangledType const & sym);
+
+  // Write the record of a symbol that failed to demangle, along with its partial symbol
+  // unless detail::unloadable_symbol() rejects it
+  void record(std::string const & mangled, DemangleResult const & result);
+
+ private:
+  void begin_record(std::string const & mangled);
+  void end_record();
+  void uinteger(std::uint64_t v);
+  void integer(std::int64_t v);
+  void string(std::string const & s);
+  void strings(std::vector<std::string> const & strings);
+  void type(DemangledType const * t);
+  void names(FullyQualifiedName const & names);
+  void node(DemangledType const & t);
+
+  std::string & out_;
+  std::size_t start_ = 0;
+  std::unordered_map<DemangledType const *, std::size_t> nodes_;
+  std::unordered_map<std::string, std::size_t> strings_;
+};
+
+// A record read by a BinaryReader.  The result holds either the symbol, or the error along
+// with the partial symbol if there was one.
+struct BinaryRecord {
+  std::string symbol;
+  DemangleResult result;
+};
+
+// Reads the stream written by a BinaryWriter from memory, throwing an Error if the data is
+// malformed or ends part way through a record.  Each type is checked for the members that the
+// text and JSON output rely on (see detail::incomplete_type()), and a partial symbol that
+// fails the check is dropped, leaving just the error.  The check is of each type on its own,
+// so a stream that wasn't written from demangler output can still hold a symbol that can't be
+// output, such as one whose conversion operator name is part of its own return type.
+class BinaryReader {
+ public:
+  BinaryReader(char const * data, std::size_t size)
+    : data_(data), p_(data), end_(data + size)
+  {}
+
+  // Types nested deeper than this are rejected, rather than exhausting the stack
+  static constexpr unsigned max_depth = 4096;
+
+  // Read and check the stream header
+  void header();
+
+  // Read the next record, returning false if there are no more.  After an Error from a bad
+  // record, the reader is left at the start of the next one.
+  bool next(BinaryRecord & record);
+
+  // The number of bytes left to read
+  std::size_t remaining() const {
+    return std::size_t(end_ - p_);
+  }
+
+ private:
+  [[noreturn]] void fail(char const * what) const;
+  void read_record(BinaryRecord & record);
+  unsigned char byte();
+  std::uint64_t uinteger();
+  std::int64_t integer();
+  std::size_t count();
+  std::string string();
+  void strings(std::vector<std::string> & strings);
+  DemangledTypePtr type();
+  void names(FullyQualifiedName & names);
+  void node(DemangledType & t);
+
+  char const * data_;
+  char const * p_;
+  char const * end_;
+  unsigned depth_ = 0;
+  // While reading a partial symbol, whether a type failed detail::incomplete_type()
+  bool partial_ = false;
+  bool incomplete_ = false;
+  std::vector<DemangledTypePtr> nodes_;
+  std::vector<std::string> strings_;
+};
+
+} // namespace demangle
+
+#endif // Include_demangle_binary
+
+/* Local Variables:   */
+/* mode: c++          */
+/* fill-column:    95 */
+/* comment-column: 0  */
+/* End:               */
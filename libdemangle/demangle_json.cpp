@@ -21,11 +21,102 @@
 // DM17-0949
 
 #include "demangle_json.hpp"
-#include <utility>              // std::move
+#include <utility>              // std::move, std::forward
+#include <vector>               // std::vector
+#include <unordered_map>        // std::unordered_map
+#include <cstring>              // std::strcmp
+#include <string>               // std::string, std::to_string
 
 namespace demangle {
 
-void JsonOutput::handle_symbol_type(Object & obj, DemangledType const & sym) const
+namespace {
+
+// Builds a tree of nodes from the same calls that would be made to a json::StreamWriter, so
+// that the tree and streaming forms of the output share their code
+class NodeWriter {
+ public:
+  NodeWriter(json::Builder const & b) : builder(b) {}
+
+  void begin_object() {
+    auto obj = builder.object();
+    auto p = obj.get();
+    if (levels.empty()) {
+      root = std::move(obj);
+      levels.push_back(Level{p, nullptr, nullptr, nullptr});
+    } else {
+      levels.push_back(Level{p, nullptr, std::move(obj), nullptr});
+    }
+  }
+  void begin_array() {
+    auto arr = builder.array();
+    auto p = arr.get();
+    levels.push_back(Level{nullptr, p, std::move(arr), nullptr});
+  }
+  void end_object() {
+    end();
+  }
+  void end_array() {
+    end();
+  }
+  void key(char const * k) {
+    levels.back().key = k;
+  }
+  template <typename T>
+  void value(T && v) {
+    add(builder.simple(json::Simple(std::forward<T>(v))));
+  }
+  template <typename T>
+  void member(char const * k, T && v) {
+    key(k);
+    value(std::forward<T>(v));
+  }
+
+  json::ObjectRef result() {
+    return std::move(root);
+  }
+
+ private:
+  struct Level {
+    json::Object * object;
+    json::Array * array;
+    json::NodeRef node;         // Owns the object or array, unless it is the root
+    char const * key;           // The key of the next member of an object
+  };
+
+  void end() {
+    auto node = std::move(levels.back().node);
+    levels.pop_back();
+    if (node) {
+      add(std::move(node));
+    }
+  }
+  void add(json::NodeRef node) {
+    auto & level = levels.back();
+    if (level.object) {
+      level.object->add(level.key, std::move(node));
+    } else {
+      level.array->add(std::move(node));
+    }
+  }
+
+  json::Builder const & builder;
+  json::ObjectRef root;
+  std::vector<Level> levels;
+};
+
+// Build an object from the members written by write(NodeWriter &)
+template <typename F>
+json::ObjectRef build(json::Builder const & builder, F const & write)
+{
+  NodeWriter w(builder);
+  w.begin_object();
+  write(w);
+  w.end_object();
+  return w.result();
+}
+
+template <typename Writer>
+void handle_symbol_type(Writer & w, DemangledType const & sym)
 {
   // Symbol type
   char const * symbol_type = nullptr;
@@ -66,11 +157,15 @@ void JsonOutput::handle_symbol_type(Object & obj, DemangledType const & sym) con
    case SymbolType::HexSymbol:
     symbol_type = "hex symbol";
     break;
+   case SymbolType::DecoratedC:
+    symbol_type = "decorated C";
+    break;
   }
-  obj.add("symbol_type", symbol_type);
+  w.member("symbol_type", symbol_type);
 }
 
-void JsonOutput::handle_scope(Object & obj, DemangledType const & sym) const
+template <typename Writer>
+void handle_scope(Writer & w, DemangledType const & sym)
 {
   char const * scope = nullptr;
   switch (sym.scope) {
@@ -86,10 +181,11 @@ void JsonOutput::handle_scope(Object & obj, DemangledType const & sym) const
     scope = "public";
     break;
   }
-  obj.add("scope", scope);
+  w.member("scope", scope);
 }
 
-void JsonOutput::handle_distance(Object & obj, DemangledType const & sym) const
+template <typename Writer>
+void handle_distance(Writer & w, DemangledType const & sym)
 {
   char const * distance = nullptr;
   switch (sym.distance) {
@@ -105,10 +201,11 @@ void JsonOutput::handle_distance(Object & obj, DemangledType const & sym) const
     distance = "huge";
     break;
   }
-  obj.add("distance", distance);
+  w.member("distance", distance);
 }
 
-void JsonOutput::handle_method_property(Object & obj, DemangledType const & sym) const
+template <typename Writer>
+void handle_method_property(Writer & w, DemangledType const & sym)
 {
   char const * prop = nullptr;
   switch (sym.method_property) {
@@ -127,78 +224,186 @@ void JsonOutput::handle_method_property(Object & obj, DemangledType const & sym)
     prop = "thunk";
     break;
   }
-  obj.add("method_property", prop);
+  w.member("method_property", prop);
 }
 
-void JsonOutput::handle_namespace(Object & obj, DemangledType const & sym) const
+template <typename Writer>
+void write_convert(Writer & w, TextOutput const & text, TextCache & cache,
+                   DemangledType const & sym);
+
+template <typename Writer>
+void handle_namespace(Writer & w, TextOutput const & text, TextCache & cache,
+                      DemangledType const & sym)
 {
   if (sym.name.empty()) {
     return;
   }
-  auto ns = builder.array();
+  w.key("namespace");
+  w.begin_array();
   for (auto & part : sym.name) {
-    ns->add(convert(*part));
+    w.begin_object();
+    write_convert(w, text, cache, *part);
+    w.end_object();
   }
-  obj.add("namespace", std::move(ns));
+  w.end_array();
 }
 
-JsonOutput::ObjectRef JsonOutput::convert(DemangledType const & sym) const
+// The parts are written before the text of the whole, so with the cache, each embedded symbol
+// is rendered once, rather than again for every symbol that it is nested in.
+template <typename Writer>
+void write_convert(Writer & w, TextOutput const & text, TextCache & cache,
+                   DemangledType const & sym)
 {
   // This is not yet finished
 
-  auto node = builder.object();
-  auto & obj = *node;
-
-  handle_symbol_type(obj, sym);
-  handle_scope(obj, sym);
+  handle_symbol_type(w, sym);
+  handle_scope(w, sym);
 
   if (sym.symbol_type == SymbolType::GlobalFunction
       || sym.symbol_type == SymbolType::ClassMethod)
   {
-    handle_distance(obj, sym);
+    handle_distance(w, sym);
     if (sym.retval) {
-      obj.add("return_type", convert(*sym.retval));
+      w.key("return_type");
+      w.begin_object();
+      write_convert(w, text, cache, *sym.retval);
+      w.end_object();
     }
-    obj.add("calling_convention", sym.calling_convention);
+    w.member("calling_convention", sym.calling_convention);
   }
-  handle_namespace(obj, sym);
+  handle_namespace(w, text, cache, sym);
+
+  w.member("text", text.convert(sym, cache));
+}
 
-  obj.add("text", text.convert(sym));
+// The state of a single raw() walk
+struct RawState {
+  RawState(TextOutput const & t, bool d) : text(t), budget(t.get_max_output()), dag(d) {}
+
+  TextOutput const & text;
+  std::size_t budget;
+  bool dag;
+  // For DAG output, the number of times that each type is referred to, and the ids given to
+  // the types referred to more than once that have been written so far
+  std::unordered_map<DemangledType const *, std::size_t> uses;
+  std::unordered_map<DemangledType const *, std::size_t> ids;
+};
+
+template <typename F>
+void for_each_child(DemangledType const & sym, F const & f)
+{
+  auto each = [&f](FullyQualifiedName const & names) {
+                for (auto & n : names) {
+                  f(*n);
+                }
+              };
+  if (sym.inner_type) {
+    f(*sym.inner_type);
+  }
+  if (sym.enum_real_type) {
+    f(*sym.enum_real_type);
+  }
+  each(sym.name);
+  each(sym.com_interface);
+  for (auto & param : sym.template_parameters) {
+    if (param && param->type) {
+      f(*param->type);
+    }
+  }
+  each(sym.instance_name);
+  if (sym.retval) {
+    f(*sym.retval);
+  }
+  each(sym.args);
+}
 
-  return node;
+void count_uses(DemangledType const & sym, RawState & state)
+{
+  if (++state.uses[&sym] == 1) {
+    for_each_child(sym, [&state](DemangledType const & t) { count_uses(t, state); });
+  }
 }
 
-JsonOutput::ObjectRef JsonOutput::raw(DemangledType const & sym) const
+template <typename Writer>
+void write_raw(Writer & w, RawState & state, DemangledType const & sym)
 {
-  auto node = builder.object();
-  auto & obj = *node;
+  // Back-references make the tree much larger than the symbol that it came from, so charge
+  // each node against the budget as it is expanded
+  auto & text = state.text;
+  if (text.get_max_output()) {
+    static constexpr std::size_t node_size = 2;
+    if (state.budget < node_size) {
+      throw OutputBudgetExceeded("JSON output exceeds the output budget of "
+                                 + std::to_string(text.get_max_output()) + " characters");
+    }
+    state.budget -= node_size;
+  }
 
-  auto add_bool = [&obj, this](char const * name, bool val) {
+  if (state.dag) {
+    // A type referred to more than once is written in full the first time, with an id that
+    // later references to it use
+    auto found = state.ids.find(&sym);
+    if (found != state.ids.end()) {
+      w.member("ref", found->second);
+      return;
+    }
+    if (state.uses[&sym] > 1) {
+      auto id = state.ids.size();
+      state.ids.emplace(&sym, id);
+      w.member("id", id);
+    }
+  }
+
+  auto add_bool = [&w](char const * name, bool val) {
                     if (val) {
-                      obj.add(name, val);
+                      w.member(name, val);
                     }
                   };
 
-  auto add_rlist = [&obj, this](char const * name, FullyQualifiedName const & names) {
+  auto add_object = [&w, &state](char const * name, DemangledType const & t) {
+                      w.key(name);
+                      w.begin_object();
+                      write_raw(w, state, t);
+                      w.end_object();
+                    };
+
+  auto add_rlist = [&w, &state](char const * name, FullyQualifiedName const & names) {
                     if (!names.empty()) {
-                      auto nlist = builder.array();
+                      w.key(name);
+                      w.begin_array();
                       for (auto i = names.rbegin(); i != names.rend(); ++i) {
-                        nlist->add(raw(**i));
+                        w.begin_object();
+                        write_raw(w, state, **i);
+                        w.end_object();
                       }
-                      obj.add(name, std::move(nlist));
+                      w.end_array();
                     }
                    };
 
-  auto add_list = [&obj, this](char const * name, FullyQualifiedName const & names) {
+  auto add_list = [&w, &state](char const * name, FullyQualifiedName const & names) {
                     if (!names.empty()) {
-                      auto nlist = builder.array();
+                      w.key(name);
+                      w.begin_array();
                       for (auto & n : names) {
-                        nlist->add(raw(*n));
+                        w.begin_object();
+                        write_raw(w, state, *n);
+                        w.end_object();
                       }
-                      obj.add(name, std::move(nlist));
+                      w.end_array();
                     }
                   };
 
+  auto add_strings = [&w](char const * name, std::vector<std::string> const & strings) {
+                       if (!strings.empty()) {
+                         w.key(name);
+                         w.begin_array();
+                         for (auto & s : strings) {
+                           w.value(s);
+                         }
+                         w.end_array();
+                       }
+                     };
+
   add_bool("is_const", sym.is_const);
   add_bool("is_volatile", sym.is_volatile);
   add_bool("is_reference", sym.is_reference);
@@ -206,11 +411,16 @@ JsonOutput::ObjectRef JsonOutput::raw(DemangledType const & sym) const
   add_bool("is_array", sym.is_array);
 
   if (!sym.dimensions.empty()) {
-    auto dim = builder.array();
+    w.key("dimensions");
+    w.begin_array();
     for (auto d : sym.dimensions) {
-      dim->add(std::intmax_t(d));
+      if (d == DemangledType::unbounded_dimension) {
+        w.value(nullptr);
+      } else {
+        w.value(std::intmax_t(d));
+      }
     }
-    obj.add("dimensions", std::move(dim));
+    w.end_array();
   }
 
   add_bool("is_embedded", sym.is_embedded);
@@ -220,108 +430,135 @@ JsonOutput::ObjectRef JsonOutput::raw(DemangledType const & sym) const
   add_bool("is_anonymous", sym.is_anonymous);
   add_bool("is_refref", sym.is_refref);
 
-  handle_symbol_type(obj, sym);
-  handle_distance(obj, sym);
+  handle_symbol_type(w, sym);
+  handle_distance(w, sym);
   if (sym.ptr64) {
-    obj.add("ptr64", sym.ptr64);
+    w.member("ptr64", sym.ptr64);
   }
   add_bool("unaligned", sym.unaligned);
   add_bool("restrict", sym.restrict);
   add_bool("is_gc", sym.is_gc);
   add_bool("is_pin", sym.is_pin);
   if (sym.inner_type) {
-    obj.add("inner_type", raw(*sym.inner_type));
+    add_object("inner_type", *sym.inner_type);
   }
   if (sym.enum_real_type) {
-    obj.add("enum_real_type", raw(*sym.enum_real_type));
+    add_object("enum_real_type", *sym.enum_real_type);
   }
   if (!sym.simple_string.empty()) {
-    obj.add("simple_string", sym.simple_string);
+    w.member("simple_string", sym.simple_string);
   }
   if (sym.simple_code != Code::UNDEFINED) {
-    obj.add("simple_code", code_string(sym.simple_code));
+    w.member("simple_code", code_string(sym.simple_code));
   }
   add_rlist("name", sym.name);
   add_list("com_interface", sym.com_interface);
   if (!sym.template_parameters.empty()) {
-    auto params = builder.array();
+    w.key("template_parameters");
+    w.begin_array();
     for (auto & param : sym.template_parameters) {
       if (param) {
-        auto p = builder.object();
+        w.begin_object();
         if (param->type) {
-          p->add("type", raw(*param->type));
+          add_object("type", *param->type);
           if (param->pointer) {
-            p->add("pointer", param->pointer);
+            w.member("pointer", param->pointer);
           }
         } else {
-          p->add("constant_value", param->constant_value);
+          w.member("constant_value", param->constant_value);
         }
-        params->add(std::move(p));
+        w.end_object();
       }
     }
-    obj.add("template_parameters", std::move(params));
+    w.end_array();
   }
-  handle_scope(obj, sym);
-  handle_method_property(obj, sym);
+  handle_scope(w, sym);
+  handle_method_property(w, sym);
   if (!sym.calling_convention.empty()) {
-    obj.add("calling_convention", sym.calling_convention);
+    w.member("calling_convention", sym.calling_convention);
   }
   add_bool("is_ctor", sym.is_ctor);
   add_bool("is_dtor", sym.is_dtor);
   add_list("instance_name", sym.instance_name);
   if (sym.retval) {
-    obj.add("retval", raw(*sym.retval));
+    add_object("retval", *sym.retval);
   }
   add_list("args", sym.args);
   if (!sym.n.empty()) {
-    auto values = builder.array();
+    w.key("n");
+    w.begin_array();
     for (auto & n : sym.n) {
-      values->add(n);
+      w.value(n);
     }
-    obj.add("n", std::move(values));
+    w.end_array();
   }
   add_bool("extern_c", sym.extern_c);
+  add_bool("is_imported", sym.is_imported);
+  add_bool("transaction_clone", sym.transaction_clone);
+  add_bool("non_transaction_clone", sym.non_transaction_clone);
+  add_strings("abi_tags", sym.abi_tags);
+  add_strings("clones", sym.clones);
+}
 
-  return node;
+template <typename Writer>
+void write_raw(Writer & w, TextOutput const & text, DemangledType const & sym, bool dag)
+{
+  RawState state(text, dag);
+  if (dag) {
+    count_uses(sym, state);
+  }
+  write_raw(w, state, sym);
 }
 
-JsonOutput::ObjectRef JsonOutput::minimal(DemangledType const & sym) const
+bool has_components(DemangledType const & sym)
 {
-  auto node = builder.object();
-  auto & obj = *node;
+  return sym.symbol_type == SymbolType::GlobalFunction
+    || sym.symbol_type == SymbolType::ClassMethod
+    || sym.symbol_type == SymbolType::DecoratedC;
+}
 
-  auto add_bool = [&obj, this](char const * name, bool val) {
+template <typename Writer>
+void write_minimal(Writer & w, TextOutput const & text, DemangledType const & sym,
+                   TextComponents const & c, bool dag)
+{
+  auto add_bool = [&w](char const * name, bool val) {
                     if (val) {
-                      obj.add(name, val);
+                      w.member(name, val);
                     }
                   };
 
-  handle_symbol_type(obj, sym);
-  handle_scope(obj, sym);
-
-  auto add_string = [&obj](char const * name, std::string && val) {
+  auto add_string = [&w](char const * name, std::string && val) {
                       if (!val.empty()) {
-                        obj.add(name, std::move(val));
+                        w.member(name, std::move(val));
                       }
                     };
 
+  if (!has_components(sym)) {
+    write_raw(w, text, sym, dag);
+    return;
+  }
+
+  handle_symbol_type(w, sym);
+  handle_scope(w, sym);
+
   if (sym.symbol_type == SymbolType::GlobalFunction
       || sym.symbol_type == SymbolType::ClassMethod)
   {
     if (!sym.calling_convention.empty()) {
-      obj.add("calling_convention", sym.calling_convention);
+      w.member("calling_convention", sym.calling_convention);
     }
-    handle_distance(obj, sym);
-    add_string("class_name", text.get_class_name(sym));
-    add_string("function_name", text.get_method_name(sym));
-    add_string("function_signature", text.get_method_signature(sym));
-
-    auto args = builder.array();
-    for (auto & arg : sym.args) {
-      args->add(text.convert(*arg));
+    handle_distance(w, sym);
+    add_string("class_name", c.str(c.class_name));
+    add_string("function_name", c.str(c.method_name));
+    add_string("function_signature", c.str(c.signature));
+
+    w.key("args");
+    w.begin_array();
+    for (auto & arg : c.args) {
+      w.value(c.str(arg));
     }
-    obj.add("args", std::move(args));
-    add_string("return_type", text.convert(*sym.retval));
+    w.end_array();
+    add_string("return_type", c.str(c.return_type));
     bool is_ctor = false;
     bool is_dtor = false;
     for (auto & part : sym.name) {
@@ -330,11 +567,168 @@ JsonOutput::ObjectRef JsonOutput::minimal(DemangledType const & sym) const
     }
     add_bool("is_ctor", is_ctor);
     add_bool("is_dtor", is_dtor);
+    add_bool("is_imported", sym.is_imported);
   } else {
-    return raw(sym);
+    if (!sym.calling_convention.empty()) {
+      w.member("calling_convention", sym.calling_convention);
+    }
+    add_string("name", c.str(c.method_name));
+    if (!sym.n.empty()) {
+      w.member("argument_bytes", sym.n[0]);
+    }
+    add_bool("is_imported", sym.is_imported);
   }
+}
 
-  return node;
+template <typename Writer>
+void write_minimal(Writer & w, TextOutput const & text, DemangledType const & sym, bool dag)
+{
+  if (has_components(sym)) {
+    write_minimal(w, text, sym, text.components(sym), dag);
+  } else {
+    write_raw(w, text, sym, dag);
+  }
+}
+
+} // unnamed namespace
+
+std::vector<char const *> const & CompactWriter::fields()
+{
+  static std::vector<char const *> const names = {
+    "symbol", "demangled", "raw", "symbol_type", "scope", "calling_convention", "distance",
+    "class_name", "function_name", "function_signature", "args", "return_type", "is_ctor",
+    "is_dtor", "name", "argument_bytes", "is_imported", "error", "error_offset", "partial"};
+  return names;
+}
+
+void CompactWriter::header()
+{
+  writer.begin_object();
+  writer.key("fields");
+  writer.begin_array();
+  for (auto name : fields()) {
+    writer.value(name);
+  }
+  writer.end_array();
+  writer.end_object();
+}
+
+void CompactWriter::begin_record()
+{
+  writer.begin_array();
+  next = 0;
+}
+
+void CompactWriter::end_record()
+{
+  writer.end_array();
+}
+
+void CompactWriter::begin_object()
+{
+  writer.begin_object();
+  ++depth;
+}
+
+void CompactWriter::end_object()
+{
+  writer.end_object();
+  --depth;
+}
+
+void CompactWriter::begin_array()
+{
+  writer.begin_array();
+  ++depth;
+}
+
+void CompactWriter::end_array()
+{
+  writer.end_array();
+  --depth;
+}
+
+void CompactWriter::key(char const * k)
+{
+  if (depth) {
+    writer.key(k);
+    return;
+  }
+  // Fill in the fields that the record skipped
+  auto & names = fields();
+  for (; next < names.size(); ++next) {
+    if (std::strcmp(names[next], k) == 0) {
+      ++next;
+      return;
+    }
+    writer.value(nullptr);
+  }
+  throw Error(std::string("Field \"") + k + "\" is out of order or not a compact field");
+}
+
+JsonOutput::ObjectRef JsonOutput::convert(DemangledType const & sym) const
+{
+  TextCache cache;
+  return build(builder, [this, &cache, &sym](NodeWriter & w) {
+      write_convert(w, text, cache, sym); });
+}
+
+JsonOutput::ObjectRef JsonOutput::raw(DemangledType const & sym) const
+{
+  return build(builder, [this, &sym](NodeWriter & w) { write_raw(w, text, sym, dag); });
+}
+
+JsonOutput::ObjectRef JsonOutput::minimal(DemangledType const & sym) const
+{
+  return build(builder, [this, &sym](NodeWriter & w) { write_minimal(w, text, sym, dag); });
+}
+
+JsonOutput::ObjectRef JsonOutput::minimal(
+  DemangledType const & sym, TextComponents const & c) const
+{
+  return build(builder, [this, &sym, &c](NodeWriter & w) {
+      write_minimal(w, text, sym, c, dag); });
+}
+
+void JsonOutput::convert(StreamWriter & w, DemangledType const & sym) const
+{
+  TextCache cache;
+  write_convert(w, text, cache, sym);
+}
+
+void JsonOutput::raw(StreamWriter & w, DemangledType const & sym) const
+{
+  write_raw(w, text, sym, dag);
+}
+
+void JsonOutput::minimal(StreamWriter & w, DemangledType const & sym) const
+{
+  write_minimal(w, text, sym, dag);
+}
+
+void JsonOutput::minimal(StreamWriter & w, DemangledType const & sym,
+                         TextComponents const & c) const
+{
+  write_minimal(w, text, sym, c, dag);
+}
+
+void JsonOutput::minimal(CompactWriter & w, DemangledType const & sym) const
+{
+  // The components are only used for the symbols that have them
+  minimal(w, sym, has_components(sym) ? text.components(sym) : TextComponents());
+}
+
+void JsonOutput::minimal(CompactWriter & w, DemangledType const & sym,
+                         TextComponents const & c) const
+{
+  if (has_components(sym)) {
+    write_minimal(w, text, sym, c, dag);
+  } else {
+    w.key("raw");
+    w.begin_object();
+    write_raw(w, text, sym, dag);
+    w.end_object();
+  }
 }
 
 
@@ -27,35 +27,121 @@
 #include "demangle_text.hpp"
 #include "json.hpp"
 
+#include <vector>               // std::vector
+
 namespace demangle {
 
+// Writes records in a compact, positional form of the minimal JSON output, for bulk export.
+// Rather than repeating the keys in every record, a header record, {"fields": [...]}, lists
+// them once, and each record is an array of the values of the fields, in that order.  Fields
+// that the record doesn't have are null, and trailing nulls are left out.
+//
+// Records are written with the same calls as to a StreamWriter, between begin_record() and
+// end_record().  The members of a record must come in the order of fields(), which is the
+// order that JsonOutput::minimal() writes them in.  Values below the top level of a record
+// are written normally, and can also be written straight to stream() after key().
+class CompactWriter {
+ public:
+  CompactWriter(json::StreamWriter & w) : writer(w) {}
+
+  // The symbol and demangled text, "raw" for symbols that minimal() writes in raw form, the
+  // fields of JsonOutput::minimal(), and the error fields
+  static std::vector<char const *> const & fields();
+
+  void header();
+  void begin_record();
+  void end_record();
+
+  void begin_object();
+  void end_object();
+  void begin_array();
+  void end_array();
+  void key(char const * k);
+  template <typename T>
+  void value(T && v) {
+    writer.value(std::forward<T>(v));
+  }
+  template <typename T>
+  void member(char const * k, T && v) {
+    key(k);
+    value(std::forward<T>(v));
+  }
+
+  json::StreamWriter & stream() {
+    return writer;
+  }
+
+ private:
+  json::StreamWriter & writer;
+  std::size_t next = 0;         // The next field of the record
+  unsigned depth = 0;           // The depth of nesting within the current field
+};
+
 class JsonOutput {
  public:
   using Builder   = json::Builder;
   using Object    = json::Object;
   using ObjectRef = json::ObjectRef;
+  using StreamWriter = json::StreamWriter;
 
  public:
   JsonOutput(Builder const & b) : builder(b) {}
   void set_attributes(TextAttributes attr) {
     text.set_attributes(attr);
   }
+  // See TextOutput::set_max_length() and TextOutput::set_max_template_depth()
+  void set_max_length(std::size_t n) {
+    text.set_max_length(n);
+  }
+  void set_max_template_depth(std::size_t n) {
+    text.set_max_template_depth(n);
+  }
+  // See TextOutput::set_max_output().  The budget also limits how many types raw() expands,
+  // counting each as the two characters of an empty JSON object.
+  void set_max_output(std::size_t n) {
+    text.set_max_output(n);
+  }
+  // In raw() output, including the raw output of minimal() for symbols that aren't functions,
+  // write types that are referred to more than once in full only the first time.  That object
+  // gets an "id" member, and later references to the type are written as {"ref": id}, so the
+  // output is linear in the size of the parsed symbol rather than of its expansion.
+  void set_dag(bool val) {
+    dag = val;
+  }
+  bool get_dag() const {
+    return dag;
+  }
+  // See TextOutput::set_dictionary()
+  void set_dictionary(TextDictionary * dict) {
+    text.set_dictionary(dict);
+  }
   ObjectRef convert(DemangledType const & sym) const;
   ObjectRef operator()(DemangledType const & sym) const {
     return convert(sym);
   }
   ObjectRef raw(DemangledType const & sym) const;
   ObjectRef minimal(DemangledType const & sym) const;
+  // As above, using text components already produced by TextOutput::components() with the
+  // same attributes
+  ObjectRef minimal(DemangledType const & sym, TextComponents const & c) const;
+
+  // Streaming forms of the above, which write straight to a StreamWriter without building any
+  // nodes.  They write the members of the object that the above would return, into an object
+  // that the caller has begun, so the caller can add members of its own around them.
+  void convert(StreamWriter & w, DemangledType const & sym) const;
+  void raw(StreamWriter & w, DemangledType const & sym) const;
+  void minimal(StreamWriter & w, DemangledType const & sym) const;
+  void minimal(StreamWriter & w, DemangledType const & sym, TextComponents const & c) const;
+
+  // The positional form of minimal().  Symbols that minimal() writes in raw form are written
+  // as an object in the "raw" field.
+  void minimal(CompactWriter & w, DemangledType const & sym) const;
+  void minimal(CompactWriter & w, DemangledType const & sym, TextComponents const & c) const;
 
  private:
   Builder const & builder;
   TextOutput text;
-
-  void handle_symbol_type(Object & obj, DemangledType const & sym) const;
-  void handle_scope(Object & obj, DemangledType const & sym) const;
-  void handle_distance(Object & obj, DemangledType const & sym) const;
-  void handle_method_property(Object & obj, DemangledType const & sym) const;
-  void handle_namespace(Object & obj, DemangledType const & sym) const;
+  bool dag = false;
 };
 
 } // namespace demangle
@@ -0,0 +1,725 @@
+// Pharos Demangler
+//
+// Copyright 2017 Carnegie Mellon University. All Rights Reserved.
+//
+// NO WARRANTY. THIS CARNEGIE MELLON UNIVERSITY AND SOFTWARE ENGINEERING
+// INSTITUTE MATERIAL IS FURNISHED ON AN "AS-IS" BASIS. CARNEGIE MELLON
+// UNIVERSITY MAKES NO WARRANTIES OF ANY KIND, EITHER EXPRESSED OR
+// IMPLIED, AS TO ANY MATTER INCLUDING, BUT NOT LIMITED TO, WARRANTY OF
+// FITNESS FOR PURPOSE OR MERCHANTABILITY, EXCLUSIVITY, OR RESULTS
+// OBTAINED FROM USE OF THE MATERIAL. CARNEGIE MELLON UNIVERSITY DOES NOT
+// MAKE ANY WARRANTY OF ANY KIND WITH RESPECT TO FREEDOM FROM PATENT,
+// TRADEMARK, OR COPYRIGHT INFRINGEMENT.
+//
+// Released under a BSD-style license, please see license.txt or contact
+// permission@sei.cmu.edu for full terms.
+//
+// [DISTRIBUTION STATEMENT A] This material has been approved for public
+// release and unlimited distribution.  Please see Copyright notice for
+// non-US Government use and distribution.
+//
+// DM17-0949
+
+#include "demangle_store.hpp"
+#include "demangle_binary.hpp"
+#include <algorithm>            // std::sort, std::lower_bound, std::min, std::find
+#include <numeric>              // std::iota
+#include <fstream>              // std::ofstream
+#include <limits>               // std::numeric_limits
+#include <cstring>              // std::memcpy, std::memcmp
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+namespace demangle {
+
+using detail::StoreHeader;
+using detail::StoreSymbol;
+using detail::StoreNodeRecord;
+using detail::StoreParamRecord;
+
+namespace {
+
+char const magic[] = {'P', 'D', 'M', 'S'};
+constexpr std::uint32_t byte_order = 0x01020304;
+
+// Types nested deeper than this are rejected when loading, rather than exhausting the stack
+constexpr unsigned max_depth = 4096;
+
+// The order of the index
+bool less(StoreString const & a, StoreString const & b)
+{
+  auto c = std::memcmp(a.data, b.data, std::min(a.size, b.size));
+  return c < 0 || (c == 0 && a.size < b.size);
+}
+
+std::uint64_t align8(std::uint64_t n)
+{
+  return (n + 7) & ~std::uint64_t(7);
+}
+
+} // unnamed namespace
+
+// ---- Writing
+
+constexpr std::uint32_t SymbolStoreWriter::version;
+
+SymbolStoreWriter::SymbolStoreWriter()
+{
+  // Offset zero is the empty list, and the empty string
+  lists.push_back(0);
+  value_lists.push_back(0);
+  string(std::string());
+}
+
+void SymbolStoreWriter::add(std::string const & mangled, DemangledType const & sym)
+{
+  auto why = detail::unloadable_symbol(sym, max_depth);
+  if (why) {
+    throw Error(std::string("Symbol can't be stored: ") + why);
+  }
+  add(mangled, &sym, std::string(), 0);
+}
+
+void SymbolStoreWriter::add(std::string const & mangled, DemangleResult const & result)
+{
+  auto partial = result.symbol.get();
+  auto why = partial ? detail::unloadable_symbol(*partial, max_depth) : nullptr;
+  if (why && result.ok()) {
+    // It's stored as a failure, since the store couldn't load it
+    add(mangled, nullptr, std::string("Symbol can't be stored: ") + why, 0);
+  } else if (why) {
+    // It couldn't be output once loaded
+    add(mangled, nullptr, result.error, result.error_offset);
+  } else {
+    add(mangled, partial, result.error, result.error_offset);
+  }
+}
+
+void SymbolStoreWriter::add(std::string const & mangled, DemangledType const * sym,
+                            std::string const & error, std::size_t error_offset)
+{
+  auto name = string(mangled);
+  if (!symbol_names.insert(name).second) {
+    return;
+  }
+  if (symbols.size() == std::numeric_limits<std::uint32_t>::max()) {
+    throw Error("Too many symbols for a symbol store");
+  }
+  node_ids.clear();
+  StoreSymbol rec;
+  rec.mangled = name;
+  rec.error = string(error);
+  rec.node = node(sym);
+  rec.error_offset = std::uint32_t(error_offset);
+  symbols.push_back(rec);
+}
+
+std::uint32_t SymbolStoreWriter::string(std::string const & s)
+{
+  auto found = string_ids.find(s);
+  if (found != string_ids.end()) {
+    return found->second;
+  }
+  auto offset = strings.size();
+  if (offset + s.size() + 8 > std::numeric_limits<std::uint32_t>::max()) {
+    throw Error("Too many strings for a symbol store");
+  }
+  auto size = std::uint32_t(s.size());
+  strings.append(reinterpret_cast<char const *>(&size), sizeof(size));
+  strings += s;
+  strings.append(4 - s.size() % 4, '\0');
+  string_ids.emplace(s, std::uint32_t(offset));
+  return std::uint32_t(offset);
+}
+
+std::uint32_t SymbolStoreWriter::list(std::vector<std::uint32_t> const & items)
+{
+  if (items.empty()) {
+    return 0;
+  }
+  auto offset = lists.size();
+  if (offset + items.size() >= std::numeric_limits<std::uint32_t>::max()) {
+    throw Error("Too many lists for a symbol store");
+  }
+  lists.push_back(std::uint32_t(items.size()));
+  lists.insert(lists.end(), items.begin(), items.end());
+  return std::uint32_t(offset);
+}
+
+template <typename T>
+std::uint32_t SymbolStoreWriter::values(std::vector<T> const & v)
+{
+  if (v.empty()) {
+    return 0;
+  }
+  auto offset = value_lists.size();
+  if (offset + v.size() >= std::numeric_limits<std::uint32_t>::max()) {
+    throw Error("Too many values for a symbol store");
+  }
+  value_lists.push_back(v.size());
+  for (auto x : v) {
+    value_lists.push_back(std::uint64_t(x));
+  }
+  return std::uint32_t(offset);
+}
+
+std::uint32_t SymbolStoreWriter::names(FullyQualifiedName const & names)
+{
+  std::vector<std::uint32_t> items;
+  items.reserve(names.size());
+  for (auto & n : names) {
+    items.push_back(node(n.get()));
+  }
+  return list(items);
+}
+
+std::uint32_t SymbolStoreWriter::string_list(std::vector<std::string> const & v)
+{
+  std::vector<std::uint32_t> items;
+  items.reserve(v.size());
+  for (auto & s : v) {
+    items.push_back(string(s));
+  }
+  return list(items);
+}
+
+// The types a node refers to are added before it, so nodes only refer back
+std::uint32_t SymbolStoreWriter::node(DemangledType const * t)
+{
+  if (!t) {
+    return 0;
+  }
+  auto found = node_ids.find(t);
+  if (found != node_ids.end()) {
+    return found->second;
+  }
+  StoreNodeRecord r = {};
+  for (std::size_t i = 0; i < detail::boolean_member_count; ++i) {
+    if (t->*detail::boolean_members[i]) {
+      r.flags |= std::uint32_t(1) << i;
+    }
+  }
+  r.enums = std::uint32_t(t->symbol_type) | std::uint32_t(t->distance) << 4
+            | std::uint32_t(t->scope) << 6 | std::uint32_t(t->method_property) << 8;
+  r.ptr64 = t->ptr64;
+  r.simple_code = static_cast<std::uint32_t>(t->simple_code);
+  r.simple_string = string(t->simple_string);
+  r.calling_convention = string(t->calling_convention);
+  r.inner_type = node(t->inner_type.get());
+  r.enum_real_type = node(t->enum_real_type.get());
+  r.retval = node(t->retval.get());
+  r.name = names(t->name);
+  r.com_interface = names(t->com_interface);
+  r.instance_name = names(t->instance_name);
+  r.args = names(t->args);
+  std::vector<std::uint32_t> tparams;
+  tparams.reserve(t->template_parameters.size());
+  for (auto & p : t->template_parameters) {
+    if (!p) {
+      tparams.push_back(0);
+      continue;
+    }
+    StoreParamRecord pr = {};
+    pr.type = node(p->type.get());
+    if (!p->type) {
+      pr.constant_value = p->constant_value;
+    }
+    pr.pointer = p->pointer;
+    params.push_back(pr);
+    tparams.push_back(std::uint32_t(params.size()));
+  }
+  r.template_parameters = list(tparams);
+  r.dimensions = values(t->dimensions);
+  r.n = values(t->n);
+  r.abi_tags = string_list(t->abi_tags);
+  r.clones = string_list(t->clones);
+  if (nodes.size() + 1 >= std::numeric_limits<std::uint32_t>::max()) {
+    throw Error("Too many types for a symbol store");
+  }
+  nodes.push_back(r);
+  auto id = std::uint32_t(nodes.size());
+  node_ids.emplace(t, id);
+  return id;
+}
+
+void SymbolStoreWriter::write(std::string const & path) const
+{
+  auto str = [this](std::uint32_t offset) {
+    std::uint32_t size;
+    std::memcpy(&size, strings.data() + offset, sizeof(size));
+    return StoreString{strings.data() + offset + sizeof(size), size};
+  };
+  std::vector<std::uint32_t> index(symbols.size());
+  std::iota(index.begin(), index.end(), 0);
+  std::sort(index.begin(), index.end(), [this, &str](std::uint32_t a, std::uint32_t b) {
+      return less(str(symbols[a].mangled), str(symbols[b].mangled)); });
+
+  StoreHeader h = {};
+  std::memcpy(h.magic, magic, sizeof(magic));
+  h.byte_order = byte_order;
+  h.version = version;
+  h.symbol_count = std::uint32_t(symbols.size());
+  h.node_count = std::uint32_t(nodes.size());
+  h.param_count = std::uint32_t(params.size());
+  h.list_count = std::uint32_t(lists.size());
+  h.value_count = std::uint32_t(value_lists.size());
+  h.string_bytes = strings.size();
+
+  struct Section {
+    std::uint64_t & offset;
+    void const * data;
+    std::size_t size;
+  };
+  Section sections[] = {
+    {h.symbols, symbols.data(), symbols.size() * sizeof(StoreSymbol)},
+    {h.index, index.data(), index.size() * sizeof(std::uint32_t)},
+    {h.nodes, nodes.data(), nodes.size() * sizeof(StoreNodeRecord)},
+    {h.params, params.data(), params.size() * sizeof(StoreParamRecord)},
+    {h.lists, lists.data(), lists.size() * sizeof(std::uint32_t)},
+    {h.values, value_lists.data(), value_lists.size() * sizeof(std::uint64_t)},
+    {h.strings, strings.data(), strings.size()}
+  };
+  std::uint64_t offset = align8(sizeof(h));
+  for (auto & s : sections) {
+    s.offset = offset;
+    offset = align8(offset + s.size);
+  }
+
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  static char const padding[8] = {};
+  auto put = [&file](void const * data, std::size_t size) {
+    file.write(static_cast<char const *>(data), std::streamsize(size));
+    file.write(padding, std::streamsize(align8(size) - size));
+  };
+  put(&h, sizeof(h));
+  for (auto & s : sections) {
+    put(s.data, s.size);
+  }
+  file.close();
+  if (!file) {
+    throw Error("Could not write the symbol store " + path);
+  }
+}
+
+// ---- Reading
+
+struct SymbolStore::Mapping {
+  boost::interprocess::file_mapping file;
+  boost::interprocess::mapped_region region;
+};
+
+SymbolStore::SymbolStore(std::string const & path)
+{
+  namespace bi = boost::interprocess;
+  try {
+    mapping = std::unique_ptr<Mapping>(new Mapping());
+    bi::file_mapping(path.c_str(), bi::read_only).swap(mapping->file);
+    bi::mapped_region(mapping->file, bi::read_only).swap(mapping->region);
+  } catch (bi::interprocess_exception const & e) {
+    throw Error("Could not map the symbol store " + path + ": " + e.what());
+  }
+  data = static_cast<char const *>(mapping->region.get_address());
+  data_size = mapping->region.get_size();
+  open();
+}
+
+SymbolStore::SymbolStore(char const * d, std::size_t size) : data(d), data_size(size)
+{
+  open();
+}
+
+SymbolStore::~SymbolStore() = default;
+
+[[noreturn]] void SymbolStore::corrupt(char const * what) const
+{
+  throw Error(std::string("Corrupt symbol store: ") + what);
+}
+
+template <typename T>
+T const * SymbolStore::section(std::uint64_t offset, std::uint64_t count) const
+{
+  if (offset % 8 || offset > data_size || count > (data_size - offset) / sizeof(T)) {
+    corrupt("section out of bounds");
+  }
+  return reinterpret_cast<T const *>(data + offset);
+}
+
+void SymbolStore::open()
+{
+  if (data_size < sizeof(StoreHeader)
+      || std::memcmp(data, magic, sizeof(magic)) != 0)
+  {
+    throw Error("Not a symbol store");
+  }
+  if (reinterpret_cast<std::uintptr_t>(data) % 8) {
+    throw Error("Symbol store is not aligned in memory");
+  }
+  header = reinterpret_cast<StoreHeader const *>(data);
+  if (header->byte_order != byte_order) {
+    throw Error("Symbol store has the wrong byte order");
+  }
+  if (header->version != SymbolStoreWriter::version) {
+    throw Error("Unsupported symbol store version");
+  }
+  auto & h = *header;
+  if (h.list_count == 0 || h.value_count == 0 || h.string_bytes < 8) {
+    corrupt("missing empty list or string");
+  }
+  symbols = section<StoreSymbol>(h.symbols, h.symbol_count);
+  index = section<std::uint32_t>(h.index, h.symbol_count);
+  nodes = section<StoreNodeRecord>(h.nodes, h.node_count);
+  params = section<StoreParamRecord>(h.params, h.param_count);
+  lists = section<std::uint32_t>(h.lists, h.list_count);
+  value_lists = section<std::uint64_t>(h.values, h.value_count);
+  strings = section<char>(h.strings, h.string_bytes);
+}
+
+StoreString SymbolStore::string(std::uint32_t offset) const
+{
+  auto bytes = header->string_bytes;
+  if (offset % 4 || offset + std::uint64_t(4) > bytes) {
+    corrupt("bad string reference");
+  }
+  std::uint32_t size;
+  std::memcpy(&size, strings + offset, sizeof(size));
+  if (size > bytes - offset - 4) {
+    corrupt("bad string length");
+  }
+  return StoreString{strings + offset + 4, size};
+}
+
+std::uint32_t const * SymbolStore::list(std::uint32_t offset, std::size_t & count) const
+{
+  if (offset >= header->list_count || lists[offset] > header->list_count - offset - 1) {
+    corrupt("bad list reference");
+  }
+  count = lists[offset];
+  return lists + offset + 1;
+}
+
+std::uint64_t const * SymbolStore::values(std::uint32_t offset, std::size_t & count) const
+{
+  if (offset >= header->value_count
+      || value_lists[offset] > header->value_count - offset - 1)
+  {
+    corrupt("bad value list reference");
+  }
+  count = std::size_t(value_lists[offset]);
+  return value_lists + offset + 1;
+}
+
+StoreSymbol const & SymbolStore::symbol_record(std::size_t i) const
+{
+  if (i >= size()) {
+    throw Error("Symbol index out of range");
+  }
+  return symbols[i];
+}
+
+std::size_t SymbolStore::find(std::string const & name) const
+{
+  StoreString key{name.data(), name.size()};
+  auto b = index;
+  auto e = index + size();
+  auto found = std::lower_bound(b, e, key, [this](std::uint32_t i, StoreString const & k) {
+      return less(mangled(i), k); });
+  if (found == e || less(key, mangled(*found))) {
+    return npos;
+  }
+  return *found;
+}
+
+StoreString SymbolStore::mangled(std::size_t i) const
+{
+  return string(symbol_record(i).mangled);
+}
+
+bool SymbolStore::ok(std::size_t i) const
+{
+  return error(i).size == 0;
+}
+
+StoreString SymbolStore::error(std::size_t i) const
+{
+  return string(symbol_record(i).error);
+}
+
+std::size_t SymbolStore::error_offset(std::size_t i) const
+{
+  return symbol_record(i).error_offset;
+}
+
+StoreNode SymbolStore::symbol(std::size_t i) const
+{
+  auto ref = symbol_record(i).node;
+  if (ref > header->node_count) {
+    corrupt("bad symbol type");
+  }
+  return StoreNode(*this, ref);
+}
+
+DemangleResult SymbolStore::load(std::size_t i) const
+{
+  DemangleResult result;
+  result.error = error(i).str();
+  result.error_offset = error_offset(i);
+  auto sym = symbol(i);
+  if (sym && result.ok()) {
+    result.symbol = sym.load();
+  } else if (sym) {
+    // A partial symbol that can't be output is left out, rather than making the store corrupt
+    std::unordered_map<std::uint32_t, DemangledTypePtr> loaded;
+    bool incomplete = false;
+    result.symbol = sym.load(loaded, 0, &incomplete);
+    if (incomplete) {
+      result.symbol.reset();
+    }
+  } else if (result.ok()) {
+    corrupt("missing symbol");
+  }
+  return result;
+}
+
+std::string SymbolStore::text(std::size_t i, TextOutput const & output) const
+{
+  auto result = load(i);
+  if (!result.ok()) {
+    throw Error(result.error);
+  }
+  return output.convert(*result.symbol);
+}
+
+StoreNodes::StoreNodes(SymbolStore const & s, std::uint32_t list, std::uint32_t p)
+  : store(&s), parent(p)
+{
+  items = s.list(list, count);
+}
+
+std::size_t StoreNodes::size() const
+{
+  return count;
+}
+
+StoreNode StoreNodes::operator[](std::size_t i) const
+{
+  if (i >= count) {
+    throw Error("Name index out of range");
+  }
+  if (items[i] == 0) {
+    store->corrupt("missing name");
+  }
+  return StoreNode(*store, parent).child(items[i]);
+}
+
+StoreNodeRecord const & StoreNode::record() const
+{
+  return store->nodes[id - 1];
+}
+
+// Nodes only refer to nodes before them
+StoreNode StoreNode::child(std::uint32_t ref) const
+{
+  if (ref >= id) {
+    store->corrupt("bad type reference");
+  }
+  return StoreNode(*store, ref);
+}
+
+bool StoreNode::get(bool DemangledType::* member) const
+{
+  auto b = detail::boolean_members;
+  auto e = b + detail::boolean_member_count;
+  auto i = std::find(b, e, member);
+  return i != e && (record().flags & (std::uint32_t(1) << (i - b)));
+}
+
+SymbolType StoreNode::symbol_type() const
+{
+  auto v = record().enums & 0xf;
+  if (v > unsigned(SymbolType::DecoratedC)) {
+    store->corrupt("bad symbol type");
+  }
+  return SymbolType(v);
+}
+
+Distance StoreNode::distance() const
+{
+  return Distance((record().enums >> 4) & 0x3);
+}
+
+Scope StoreNode::scope() const
+{
+  return Scope((record().enums >> 6) & 0x3);
+}
+
+MethodProperty StoreNode::method_property() const
+{
+  auto v = (record().enums >> 8) & 0x7;
+  if (v > unsigned(MethodProperty::Thunk)) {
+    store->corrupt("bad method property");
+  }
+  return MethodProperty(v);
+}
+
+int StoreNode::ptr64() const
+{
+  return record().ptr64;
+}
+
+Code StoreNode::simple_code() const
+{
+  auto v = record().simple_code;
+  if (v >= detail::code_count) {
+    store->corrupt("bad code");
+  }
+  return Code(v);
+}
+
+StoreString StoreNode::simple_string() const
+{
+  return store->string(record().simple_string);
+}
+
+StoreString StoreNode::calling_convention() const
+{
+  return store->string(record().calling_convention);
+}
+
+StoreNode StoreNode::inner_type() const
+{
+  return child(record().inner_type);
+}
+
+StoreNode StoreNode::enum_real_type() const
+{
+  return child(record().enum_real_type);
+}
+
+StoreNode StoreNode::retval() const
+{
+  return child(record().retval);
+}
+
+StoreNodes StoreNode::name() const
+{
+  return StoreNodes(*store, record().name, id);
+}
+
+StoreNodes StoreNode::com_interface() const
+{
+  return StoreNodes(*store, record().com_interface, id);
+}
+
+StoreNodes StoreNode::instance_name() const
+{
+  return StoreNodes(*store, record().instance_name, id);
+}
+
+StoreNodes StoreNode::args() const
+{
+  return StoreNodes(*store, record().args, id);
+}
+
+DemangledTypePtr StoreNode::load() const
+{
+  std::unordered_map<std::uint32_t, DemangledTypePtr> loaded;
+  return load(loaded, 0, nullptr);
+}
+
+// Types that are shared within the symbol are loaded once, and stay shared.  A type that can't
+// be output makes the store corrupt, unless incomplete is given, in which case it is set
+// instead.
+DemangledTypePtr StoreNode::load(std::unordered_map<std::uint32_t, DemangledTypePtr> & loaded,
+                                 unsigned depth, bool * incomplete) const
+{
+  if (!id) {
+    return nullptr;
+  }
+  auto found = loaded.find(id);
+  if (found != loaded.end()) {
+    return found->second;
+  }
+  if (depth == max_depth) {
+    store->corrupt("types nested too deeply");
+  }
+  auto & r = record();
+  auto t = std::make_shared<DemangledType>();
+  for (std::size_t i = 0; i < detail::boolean_member_count; ++i) {
+    t.get()->*detail::boolean_members[i] = r.flags & (std::uint32_t(1) << i);
+  }
+  t->symbol_type = symbol_type();
+  t->distance = distance();
+  t->scope = scope();
+  t->method_property = method_property();
+  t->ptr64 = ptr64();
+  t->simple_code = simple_code();
+  t->simple_string = simple_string().str();
+  t->calling_convention = calling_convention().str();
+  t->inner_type = inner_type().load(loaded, depth + 1, incomplete);
+  t->enum_real_type = enum_real_type().load(loaded, depth + 1, incomplete);
+  t->retval = retval().load(loaded, depth + 1, incomplete);
+  auto load_names = [&loaded, depth, incomplete](StoreNodes const & names,
+                                                 FullyQualifiedName & to)
+  {
+    to.reserve(names.size());
+    for (std::size_t i = 0; i < names.size(); ++i) {
+      to.push_back(names[i].load(loaded, depth + 1, incomplete));
+    }
+  };
+  load_names(name(), t->name);
+  load_names(com_interface(), t->com_interface);
+  load_names(instance_name(), t->instance_name);
+  load_names(args(), t->args);
+  std::size_t count;
+  auto tparams = store->list(r.template_parameters, count);
+  t->template_parameters.reserve(count);
+  for (std::size_t i = 0; i < count; ++i) {
+    DemangledTemplateParameterPtr p;
+    if (tparams[i]) {
+      if (tparams[i] > store->header->param_count) {
+        store->corrupt("bad template parameter reference");
+      }
+      auto & pr = store->params[tparams[i] - 1];
+      if (pr.type) {
+        auto type = child(pr.type).load(loaded, depth + 1, incomplete);
+        p = std::make_shared<DemangledTemplateParameter>(type);
+      } else {
+        p = std::make_shared<DemangledTemplateParameter>(pr.constant_value);
+      }
+      p->pointer = pr.pointer;
+    }
+    t->template_parameters.push_back(std::move(p));
+  }
+  auto dims = store->values(r.dimensions, count);
+  t->dimensions.assign(dims, dims + count);
+  auto n = store->values(r.n, count);
+  for (std::size_t i = 0; i < count; ++i) {
+    t->n.push_back(std::int64_t(n[i]));
+  }
+  auto load_strings = [this](std::uint32_t list, std::vector<std::string> & to) {
+    std::size_t size;
+    auto items = store->list(list, size);
+    to.reserve(size);
+    for (std::size_t i = 0; i < size; ++i) {
+      to.push_back(store->string(items[i]).str());
+    }
+  };
+  load_strings(r.abi_tags, t->abi_tags);
+  load_strings(r.clones, t->clones);
+  auto why = detail::incomplete_type(*t);
+  if (why && incomplete) {
+    *incomplete = true;
+  } else if (why) {
+    store->corrupt(why);
+  }
+  loaded.emplace(id, t);
+  return t;
+}
+
+} // namespace demangle
+
+/* Local Variables:   */
+/* mode: c++          */
+/* fill-column:    95 */
+/* comment-column: 0  */
+/* End:               */
@@ -0,0 +1,312 @@
+// Pharos Demangler
+//
+// Copyright 2017-2020 Carnegie Mellon University. All Rights Reserved.
+//
+// NO WARRANTY. THIS CARNEGIE MELLON UNIVERSITY AND SOFTWARE ENGINEERING
+// INSTITUTE MATERIAL IS FURNISHED ON AN "AS-IS" BASIS. CARNEGIE MELLON
+// UNIVERSITY MAKES NO WARRANTIES OF ANY KIND, EITHER EXPRESSED OR
+// IMPLIED, AS TO ANY MATTER INCLUDING, BUT NOT LIMITED TO, WARRANTY OF
+// FITNESS FOR PURPOSE OR MERCHANTABILITY, EXCLUSIVITY, OR RESULTS
+// OBTAINED FROM USE OF THE MATERIAL. CARNEGIE MELLON UNIVERSITY DOES NOT
+// MAKE ANY WARRANTY OF ANY KIND WITH RESPECT TO FREEDOM FROM PATENT,
+// TRADEMARK, OR COPYRIGHT INFRINGEMENT.
+//
+// Released under a BSD-style license, please see license.txt or contact
+// permission@sei.cmu.edu for full terms.
+//
+// [DISTRIBUTION STATEMENT A] This material has been approved for public
+// release and unlimited distribution.  Please see Copyright notice for
+// non-US Government use and distribution.
+//
+// DM17-0949
+
+
+#ifndef Include_demangle_store
+#define Include_demangle_store
+
+#include "demangle.hpp"
+#include "demangle_text.hpp"
+
+#include <string>               // std::string
+#include <vector>               // std::vector
+#include <memory>               // std::unique_ptr
+#include <unordered_map>        // std::unordered_map
+#include <unordered_set>        // std::unordered_set
+#include <cstdint>              // std::uint32_t, std::uint64_t, std::int64_t
+
+namespace demangle {
+
+namespace detail {
+
+// The layout of a symbol store file, all in native byte order.  The file is the header,
+// followed by these sections, each starting at a multiple of 8 bytes:
+//
+//   symbols  StoreSymbol for each symbol, in the order that they were added
+//   index    the uint32_t indexes of the symbols, sorted by mangled name
+//   nodes    StoreNodeRecord for each type, with a symbol's types after the types they use
+//   params   StoreParamRecord for each template parameter
+//   lists    uint32_t lists, each the count followed by the items
+//   values   uint64_t lists, likewise
+//   strings  each string is its uint32_t length, the bytes, and a NUL, padded to 4 bytes
+//
+// References to nodes and parameters are the index plus one, with zero meaning none.  Lists
+// and strings are referred to by their offset into their section, in items for lists and
+// bytes for strings, and offset zero is always the empty list or string.  The strings are
+// interned across the whole store.
+struct StoreHeader {
+  char magic[4];                // "PDMS"
+  std::uint32_t byte_order;     // 0x01020304, written natively
+  std::uint32_t version;
+  std::uint32_t symbol_count;
+  std::uint32_t node_count;
+  std::uint32_t param_count;
+  std::uint32_t list_count;
+  std::uint32_t value_count;
+  std::uint64_t string_bytes;
+  // The offsets of the sections from the start of the file
+  std::uint64_t symbols;
+  std::uint64_t index;
+  std::uint64_t nodes;
+  std::uint64_t params;
+  std::uint64_t lists;
+  std::uint64_t values;
+  std::uint64_t strings;
+};
+
+struct StoreSymbol {
+  std::uint32_t mangled;        // string
+  std::uint32_t error;          // string, empty if the symbol demangled
+  std::uint32_t node;           // the symbol, or the partial symbol if any
+  std::uint32_t error_offset;
+};
+
+struct StoreNodeRecord {
+  std::uint32_t flags;          // boolean_members
+  std::uint32_t enums;          // the enum members, as in the binary encoding
+  std::int32_t ptr64;
+  std::uint32_t simple_code;
+  std::uint32_t simple_string;  // string
+  std::uint32_t calling_convention; // string
+  std::uint32_t inner_type;     // node
+  std::uint32_t enum_real_type; // node
+  std::uint32_t retval;         // node
+  std::uint32_t name;           // list of nodes
+  std::uint32_t com_interface;  // list of nodes
+  std::uint32_t instance_name;  // list of nodes
+  std::uint32_t args;           // list of nodes
+  std::uint32_t template_parameters; // list of params
+  std::uint32_t dimensions;     // values
+  std::uint32_t n;              // values, as int64_t
+  std::uint32_t abi_tags;       // list of strings
+  std::uint32_t clones;         // list of strings
+};
+
+struct StoreParamRecord {
+  std::int64_t constant_value;
+  std::uint32_t type;           // node
+  std::uint32_t pointer;
+};
+
+} // namespace detail
+
+// Collects parsed symbols, and writes them to a file that a SymbolStore can map.  Symbols that
+// share types keep sharing them in the store, and each string is stored once.
+class SymbolStoreWriter {
+ public:
+  SymbolStoreWriter();
+
+  static constexpr std::uint32_t version = 2;
+
+  // Add a symbol that demangled, or one that failed to, along with its partial symbol unless
+  // detail::unloadable_symbol() rejects it.  A symbol that has already been added is ignored.
+  // A symbol that demangled but that the store couldn't load (see detail::unloadable_symbol())
+  // throws an Error when added on its own, and is stored as a failure when added as a result.
+  void add(std::string const & mangled, DemangledType const & sym);
+  void add(std::string const & mangled, DemangleResult const & result);
+
+  // The number of symbols added
+  std::size_t size() const {
+    return symbols.size();
+  }
+
+  // Write the store, throwing an Error if the file can't be written
+  void write(std::string const & path) const;
+
+ private:
+  void add(std::string const & mangled, DemangledType const * sym, std::string const & error,
+           std::size_t error_offset);
+  std::uint32_t string(std::string const & s);
+  std::uint32_t node(DemangledType const * t);
+  std::uint32_t names(FullyQualifiedName const & names);
+  std::uint32_t string_list(std::vector<std::string> const & v);
+  std::uint32_t list(std::vector<std::uint32_t> const & items);
+  template <typename T>
+  std::uint32_t values(std::vector<T> const & v);
+
+  std::vector<detail::StoreSymbol> symbols;
+  std::vector<detail::StoreNodeRecord> nodes;
+  std::vector<detail::StoreParamRecord> params;
+  std::vector<std::uint32_t> lists;
+  std::vector<std::uint64_t> value_lists;
+  std::string strings;
+  std::unordered_map<std::string, std::uint32_t> string_ids;
+  std::unordered_set<std::uint32_t> symbol_names;
+  // The nodes of the symbol being added
+  std::unordered_map<DemangledType const *, std::uint32_t> node_ids;
+};
+
+class SymbolStore;
+
+// A string in a mapped store
+struct StoreString {
+  char const * data;
+  std::size_t size;
+
+  std::string str() const {
+    return std::string(data, size);
+  }
+};
+
+class StoreNode;
+
+// A list of nodes in a mapped store
+class StoreNodes {
+ public:
+  std::size_t size() const;
+  StoreNode operator[](std::size_t i) const;
+
+ private:
+  friend class StoreNode;
+  StoreNodes(SymbolStore const & s, std::uint32_t list, std::uint32_t parent);
+
+  SymbolStore const * store;
+  std::uint32_t const * items;
+  std::size_t count;
+  std::uint32_t parent;
+};
+
+// A type in a mapped store, read in place.  The members are those of DemangledType, apart
+// from the template parameters, dimensions, n, abi_tags, and clones, which only load()
+// provides.
+class StoreNode {
+ public:
+  bool get(bool DemangledType::* member) const;
+  SymbolType symbol_type() const;
+  Distance distance() const;
+  Scope scope() const;
+  MethodProperty method_property() const;
+  int ptr64() const;
+  Code simple_code() const;
+  StoreString simple_string() const;
+  StoreString calling_convention() const;
+
+  // These are null (false when tested) if the type doesn't have them
+  StoreNode inner_type() const;
+  StoreNode enum_real_type() const;
+  StoreNode retval() const;
+
+  StoreNodes name() const;
+  StoreNodes com_interface() const;
+  StoreNodes instance_name() const;
+  StoreNodes args() const;
+
+  explicit operator bool() const {
+    return id != 0;
+  }
+
+  // Build the type as a DemangledType, along with everything it refers to
+  DemangledTypePtr load() const;
+
+ private:
+  friend class SymbolStore;
+  friend class StoreNodes;
+  StoreNode(SymbolStore const & s, std::uint32_t i) : store(&s), id(i) {}
+  detail::StoreNodeRecord const & record() const;
+  StoreNode child(std::uint32_t ref) const;
+  DemangledTypePtr load(std::unordered_map<std::uint32_t, DemangledTypePtr> & loaded,
+                        unsigned depth, bool * incomplete) const;
+
+  SymbolStore const * store;
+  std::uint32_t id;             // index plus one
+};
+
+// A symbol store file (see SymbolStoreWriter), mapped into memory rather than read, so that
+// opening one takes the same time whatever its size.  Symbols are found by their mangled
+// names through the index, and their types can be examined in place as StoreNodes.  A symbol
+// is only built as DemangledTypes, for output, when it is loaded.
+//
+// A store is checked when it is opened only as far as can be done without reading all of it.
+// Bad references are caught when they are followed, by throwing an Error.  Nodes only refer
+// to nodes before them, so there can be no cycles.
+class SymbolStore {
+ public:
+  static constexpr std::size_t npos = std::size_t(-1);
+
+  // Map a store file, throwing an Error if it can't be, or isn't a store
+  explicit SymbolStore(std::string const & path);
+  // Use a store that is already in memory, which must outlive this and be aligned to 8 bytes
+  SymbolStore(char const * data, std::size_t size);
+  ~SymbolStore();
+
+  SymbolStore(SymbolStore const &) = delete;
+  SymbolStore & operator=(SymbolStore const &) = delete;
+
+  // The number of symbols
+  std::size_t size() const {
+    return header->symbol_count;
+  }
+
+  // The index of the symbol with a mangled name, or npos if there isn't one
+  std::size_t find(std::string const & mangled) const;
+
+  StoreString mangled(std::size_t i) const;
+  // Whether the symbol demangled, and if it didn't, the error, and where it occurred
+  bool ok(std::size_t i) const;
+  StoreString error(std::size_t i) const;
+  std::size_t error_offset(std::size_t i) const;
+  // The symbol, or the partial symbol of one that failed (which may be null)
+  StoreNode symbol(std::size_t i) const;
+
+  // The symbol as it would have been returned by demangle_partial(), except that a partial
+  // symbol with a type that can't be output is left out
+  DemangleResult load(std::size_t i) const;
+
+  // Render a symbol that demangled as text, throwing an Error for one that didn't
+  std::string text(std::size_t i, TextOutput const & output) const;
+
+ private:
+  friend class StoreNode;
+  friend class StoreNodes;
+  struct Mapping;
+
+  void open();
+  [[noreturn]] void corrupt(char const * what) const;
+  detail::StoreSymbol const & symbol_record(std::size_t i) const;
+  StoreString string(std::uint32_t offset) const;
+  std::uint32_t const * list(std::uint32_t offset, std::size_t & count) const;
+  std::uint64_t const * values(std::uint32_t offset, std::size_t & count) const;
+  template <typename T>
+  T const * section(std::uint64_t offset, std::uint64_t count) const;
+
+  std::unique_ptr<Mapping> mapping;
+  char const * data;
+  std::size_t data_size;
+  detail::StoreHeader const * header = nullptr;
+  detail::StoreSymbol const * symbols = nullptr;
+  std::uint32_t const * index = nullptr;
+  detail::StoreNodeRecord const * nodes = nullptr;
+  detail::StoreParamRecord const * params = nullptr;
+  std::uint32_t const * lists = nullptr;
+  std::uint64_t const * value_lists = nullptr;
+  char const * strings = nullptr;
+};
+
+} // namespace demangle
+
+#endif // Include_demangle_store
+
+/* Local Variables:   */
+/* mode: c++          */
+/* fill-column:    95 */
+/* comment-column: 0  */
+/* End:               */
@@ -22,10 +22,13 @@
 
 #include "demangle_text.hpp"
 #include <utility>              // std::move, std::forward
-#include <sstream>              // std::ostringstream
 #include <iterator>             // std::prev
-#include <functional>           // std::function
 #include <cassert>              // assert
+#include <cstring>              // std::strlen, std::memcpy
+#include <algorithm>            // std::min, std::none_of, std::any_of
+#include <map>                  // std::map
+#include <tuple>                // std::tuple
+#include <unordered_set>        // std::unordered_set
 
 namespace demangle {
 
@@ -33,117 +36,577 @@ namespace detail {
 
 constexpr bool SPACE_MUNGING = true;
 
-class Converter {
+template <typename Stream>
+Stream & operator<<(Stream & stream, Scope scope) {
+  switch (scope) {
+   case Scope::Unspecified: break;
+   case Scope::Private: stream << "private: "; break;
+   case Scope::Protected: stream << "protected: "; break;
+   case Scope::Public: stream << "public: "; break;
+  }
+  return stream;
+}
 
-  template <typename T>
-  struct Raw {
-    T val;
-  };
+template <typename Stream>
+Stream & operator<<(Stream & stream, Distance distance) {
+  switch (distance) {
+   case Distance::Unspecified: break;
+   case Distance::Near: stream << "near "; break;
+   case Distance::Far: stream << "far "; break;
+   case Distance::Huge: stream << "huge "; break;
+  }
+  return stream;
+}
+
+// Thrown by a TextSink when its length limit is reached, to stop rendering early
+struct LimitReached {};
+
+// Where rendered text goes: appended to a string, copied into a fixed-size buffer, or just
+// counted.  The length is always the full length of the text, even when a buffer is too small.
+// A sink with a limit stops at that length.
+class TextSink {
+ public:
+  static constexpr std::size_t no_limit = std::size_t(-1);
+
+  TextSink() = default;
+  explicit TextSink(std::string & s) : str(&s), start(s.size()) {}
+  TextSink(char * b, std::size_t c) : buf(b), cap(c) {}
+
+  void set_limit(std::size_t n) {
+    limit = n;
+  }
+  bool limited() const {
+    return limit != no_limit;
+  }
+  std::size_t remaining() const {
+    return limit - len;
+  }
+
+  void write(char const * s, std::size_t n) {
+    if (limit - len < n) {
+      raw_write(s, limit - len);
+      throw LimitReached();
+    }
+    raw_write(s, n);
+  }
+
+  void put(char c) {
+    if (len == limit) {
+      throw LimitReached();
+    }
+    if (str) {
+      *str += c;
+    } else if (len < cap) {
+      buf[len] = c;
+    }
+    ++len;
+  }
+
+  // After reaching the limit, replace the end of the text with "..."
+  void abbreviate() {
+    static char const marker[] = "...";
+    auto mlen = std::min(sizeof(marker) - 1, limit);
+    len = limit - mlen;
+    if (str) {
+      str->resize(start + len);
+    }
+    raw_write(marker, mlen);
+  }
+
+  // After reaching the limit, remove what was appended to the string.  A buffer is left as it
+  // is.
+  void discard() {
+    if (str) {
+      str->resize(start);
+    }
+  }
+
+  std::size_t length() const {
+    return len;
+  }
+
+ private:
+  void raw_write(char const * s, std::size_t n) {
+    if (str) {
+      str->append(s, n);
+    } else if (len < cap) {
+      std::memcpy(buf + len, s, std::min(n, cap - len));
+    }
+    len += n;
+  }
+
+  std::string * str = nullptr;
+  std::size_t start = 0;
+  char * buf = nullptr;
+  std::size_t cap = 0;
+  std::size_t len = 0;
+  std::size_t limit = no_limit;
+};
+
+// Where the parts of a function's name landed in the output (see TextOutput::components()).
+// Only valid when split is true, meaning that the name was written as the class name, "::",
+// and the method name, in the same context as get_class_name() and get_method_name() would
+// have.
+struct NameSpans {
+  bool split = false;
+  std::size_t prefix_end = 0;
+  std::size_t name_begin = 0;
+  std::size_t class_end = 0;
+  std::size_t method_begin = 0;
+  std::size_t method_end = 0;
+  char before_method = ' ';
+};
+
+// Attributes known at compile time, so that the converter for a preset can fold away the
+// attribute tests.  Any other attributes use TextAttributes itself.
+template <std::uint32_t Bits>
+struct FixedAttributes {
+  constexpr bool operator[](TextAttribute a) const {
+    return Bits & static_cast<std::uint32_t>(a);
+  }
+};
+
+template <typename T>
+struct Raw {
+  T val;
+};
+
+template <typename T>
+Raw<T> raw(T val) {
+  return Raw<T>{val};
+}
+
+// Rendered text of shared nodes (see Converter::do_shared_type()).  Besides the node, the text
+// depends on the converter state and the preceding character, so those are part of the key.
+// The value is the text along with the last character it left behind.
+struct Memo {
+  // The node, the return value, template_parameters_, in_op_type, do_cconv, and the template
+  // nesting depth
+  using State = std::tuple<DemangledType const *, DemangledType const *,
+                           bool, bool, bool, std::size_t>;
+  using Key = std::tuple<DemangledType const *, DemangledType const *,
+                         bool, bool, bool, std::size_t, char>;
+  std::map<Key, std::pair<std::string, char>> entries;
+};
+
+// Appends directly to a sink, tracking the last character written for the space munging
+// rules.  Sub-converters share the sink, but start with their own fresh last character.
+template <typename Attributes>
+struct ConvStream {
+  TextSink * out;
+  Attributes const attr;
+
+  ConvStream(TextSink & o, Attributes const & a) : out(&o), attr(a) {}
+
+  ConvStream sub() const {
+    return ConvStream(*out, attr);
+  }
+
+  // Output conditional on an attribute
+  template <typename F>
+  void when(TextAttribute a, F const & f) {
+    if (attr[a]) f();
+  }
+  template <typename F>
+  void unless(TextAttribute a, F const & f) {
+    if (!attr[a]) f();
+  }
+
+  // Output the text of a shared node, rendering it only the first time it is seen in a given
+  // state (see Converter::do_shared_type()).
+  template <typename F>
+  void shared(Memo & memo, Memo::State const & state, F const & render) {
+    auto key = std::tuple_cat(state, std::make_tuple(last));
+    auto found = memo.entries.find(key);
+    if (found != memo.entries.end()) {
+      splice(found->second.first, found->second.second);
+      return;
+    }
+    auto text = capture(render);
+    splice(text, last);
+    memo.entries.emplace(key, std::make_pair(std::move(text), last));
+  }
+
+  // Output the alias for the rendered text if the dictionary has one, or the text otherwise
+  template <typename F>
+  void aliased(TextDictionary & dictionary, F const & render) {
+    auto before = last;
+    auto text = capture(render);
+    auto alias = dictionary.lookup(text);
+    if (alias) {
+      last = before;
+      (*this) << *alias;
+    } else {
+      splice(text, last);
+    }
+  }
+
+  // Output the cached text of an embedded symbol, or render it if there is none.  Either way
+  // it is rendered by a sub-converter, which leaves last alone.
+  template <typename F>
+  void cached(TextCache const & cache, DemangledType const & sym, F const & render) {
+    auto text = cache.find(sym);
+    if (text) {
+      out->write(text->data(), text->size());
+    } else {
+      render();
+    }
+  }
+
+  // Render into a string rather than the sink, leaving last as the rendering left it.  The
+  // capture is limited to what remains of the sink's limit, and if it reaches that, what was
+  // captured goes to the sink before rendering stops.
+  template <typename F>
+  std::string capture(F const & render) {
+    std::string text;
+    TextSink sink(text);
+    if (out->limited()) {
+      sink.set_limit(out->remaining());
+    }
+    auto saved = out;
+    out = &sink;
+    try {
+      render();
+    } catch (LimitReached const &) {
+      out = saved;
+      out->write(text.data(), text.size());
+      throw;
+    }
+    out = saved;
+    return text;
+  }
+
+  // Spans are recorded in terms of the sink's length
+  static constexpr bool records_spans = true;
+  std::size_t length() const {
+    return out->length();
+  }
+  char previous() const {
+    return last;
+  }
 
   template <typename T>
-  static Raw<T> raw(T val) {
-    return Raw<T>{val};
+  ConvStream & operator<<(Raw<T> const & x) {
+    out->put(x.val);
+    last = '\0';
+    return *this;
   }
 
-  struct ConvStream {
-    std::ostream & stream;
-    TextAttributes const & attr;
+  ConvStream & operator<<(uint64_t v) {
+    char digits[24];
+    char * e = digits + sizeof(digits);
+    char * b = e;
+    do {
+      *--b = char('0' + v % 10);
+      v /= 10;
+    } while (v);
+    return append(b, std::size_t(e - b));
+  }
 
-    ConvStream(std::ostream & s, TextAttributes const & a) : stream(s), attr(a) {}
+  ConvStream & operator<<(int64_t v) {
+    if (v >= 0) {
+      return (*this) << uint64_t(v);
+    }
+    append("-", 1);
+    return (*this) << (uint64_t(0) - uint64_t(v));
+  }
 
-    template <typename T>
-    ConvStream & operator<<(Raw<T> && x) {
-      stream << x.val;
-      last = '\0';
-      return *this;
+  static bool is_symbol_char(char c) {
+    return c == '_' || std::isalnum(c);
+  }
+
+  ConvStream & append(char const * s, std::size_t n) {
+    if (SPACE_MUNGING && n && is_symbol_char(last) && is_symbol_char(s[0])) {
+      // Ensure a space between symbols
+      out->put(' ');
+    } else if (SPACE_MUNGING && last == ' ' && n && s[0] == ' ') {
+      // Don't allow double-spaces
+      ++s;
+      --n;
+    }
+    out->write(s, n);
+    if (n) {
+      last = s[n - 1];
     }
+    fixup();
+    return *this;
+  }
+
+  ConvStream & operator<<(std::string const & s) {
+    return append(s.data(), s.size());
+  }
+
+  ConvStream & operator<<(char const * s) {
+    return append(s, std::strlen(s));
+  }
 
-    template <typename T>
-    ConvStream & operator<<(T && x) {
-      std::ostringstream os;
-      os << std::forward<T>(x);
-      (*this) << os.str();
+  ConvStream & operator<<(Code c) {
+    auto v = code_view(c);
+    return append(v.data, v.size);
+  }
+
+  ConvStream & operator<<(char c) {
+    if (SPACE_MUNGING && c == ' ' && c == last) {
+      // Don't allow double-spaces
       return *this;
     }
+    if ((c == '<' || c == '>') && c == last
+        && attr[TextAttribute::SPACE_BETWEEN_TEMPLATE_BRACKETS])
+    {
+      (*this) << ' ';
+    }
+    out->put(c);
+    last = c;
+    fixup();
+    return *this;
+  }
 
-    ConvStream & operator<<(std::string && x) {
-      (*this) << const_cast<std::string const &>(x);
-      return *this;
+  // Output previously rendered text verbatim, along with the last character it ended with
+  void splice(std::string const & s, char l) {
+    out->write(s.data(), s.size());
+    last = l;
+  }
+
+  void fixup() {
+    if (last == ',' && attr[TextAttribute::SPACE_AFTER_COMMA]) {
+      (*this) << ' ';
+      last = ' ';
     }
+  }
+
+  char last = ' ';
+};
 
-    static bool is_symbol_char(char c) {
-      return c == '_' || std::isalnum(c);
+// Writes the same output to several ConvStreams (lanes) with different attributes at once.
+// Output that depends on an attribute only goes to the lanes that it applies to, so everything
+// else is shared.  A lane whose sink reaches its limit stops there, and the others carry on
+// until every lane has stopped.  The stopped lanes are shared with sub-streams, which write to
+// the same sinks.
+class MultiStream {
+ public:
+  using Lane = ConvStream<TextAttributes>;
+  // The lanes are tracked using a bit mask
+  static constexpr std::size_t max_lanes = 64;
+
+  MultiStream(std::vector<Lane> l, std::uint64_t & s) : lanes(std::move(l)), stopped(&s) {
+    all = lanes.size() == max_lanes ? ~std::uint64_t(0)
+          : (std::uint64_t(1) << lanes.size()) - 1;
+    active = all;
+  }
+
+  MultiStream sub() const {
+    std::vector<Lane> sublanes;
+    sublanes.reserve(lanes.size());
+    for (auto & lane : lanes) {
+      sublanes.push_back(lane.sub());
     }
+    MultiStream result(std::move(sublanes), *stopped);
+    result.active = active;
+    return result;
+  }
 
-    ConvStream & operator<<(std::string const & s) {
-      if (SPACE_MUNGING && !s.empty() && is_symbol_char(last) && is_symbol_char(s.front())) {
-        // Ensure a space between symbols
-        stream << ' ' << s;
-      } else if (SPACE_MUNGING && last == ' ' && !s.empty() && s.front() == ' ') {
-        // Don't allow double-spaces
-        stream << s.substr(1);
-      } else {
-        stream << s;
+  template <typename F>
+  void when(TextAttribute a, F const & f) {
+    select(a, true, f);
+  }
+  template <typename F>
+  void unless(TextAttribute a, F const & f) {
+    select(a, false, f);
+  }
+
+  // The state of each lane differs, so shared nodes are just rendered again, and cached text
+  // is not used
+  template <typename F>
+  void shared(Memo &, Memo::State const &, F const & render) {
+    render();
+  }
+
+  // The text differs between lanes, so each lane's is captured and looked up separately (see
+  // ConvStream::aliased())
+  template <typename F>
+  void aliased(TextDictionary & dictionary, F const & render) {
+    auto live = active & ~*stopped;
+    std::vector<std::string> texts(lanes.size());
+    std::vector<TextSink> sinks;
+    sinks.reserve(lanes.size());
+    std::vector<TextSink *> outs(lanes.size());
+    std::vector<char> before(lanes.size());
+    for (std::size_t i = 0; i < lanes.size(); ++i) {
+      sinks.emplace_back(texts[i]);
+      if (live & (std::uint64_t(1) << i)) {
+        if (lanes[i].out->limited()) {
+          sinks[i].set_limit(lanes[i].out->remaining());
+        }
+        outs[i] = lanes[i].out;
+        before[i] = lanes[i].last;
+        lanes[i].out = &sinks[i];
       }
-      if (!s.empty()) {
-        last = s.back();
+    }
+    bool done = false;
+    try {
+      render();
+    } catch (LimitReached const &) {
+      done = true;
+    }
+    for (std::size_t i = 0; i < lanes.size(); ++i) {
+      auto bit = std::uint64_t(1) << i;
+      if (!(live & bit)) {
+        continue;
+      }
+      auto & lane = lanes[i];
+      lane.out = outs[i];
+      auto alias = (*stopped & bit) ? nullptr : dictionary.lookup(texts[i]);
+      try {
+        if (alias) {
+          lane.last = before[i];
+          lane << *alias;
+        } else {
+          // Text captured up to the limit fits in what remained of it
+          lane.splice(texts[i], lane.last);
+        }
+      } catch (LimitReached const &) {
+        *stopped |= bit;
       }
-      fixup();
-      return *this;
     }
-
-    ConvStream & operator<<(char const * s) {
-      return (*this) << std::string(s);
+    if (done || *stopped == all) {
+      throw LimitReached();
     }
+  }
+  template <typename F>
+  void cached(TextCache const &, DemangledType const &, F const & render) {
+    render();
+  }
 
-    ConvStream & operator<<(char c) {
-      if (SPACE_MUNGING && c == ' ' && c == last) {
-        // Don't allow double-spaces
-        return *this;
-      }
-      if ((c == '<' || c == '>') && c == last
-          && attr[TextAttribute::SPACE_BETWEEN_TEMPLATE_BRACKETS])
-      {
-        (*this) << ' ';
+  // Spans are only recorded for a single output (see Converter::do_split_name())
+  static constexpr bool records_spans = false;
+  std::size_t length() const {
+    return 0;
+  }
+  char previous() const {
+    return '\0';
+  }
+
+  MultiStream & operator<<(char x) { return each(x); }
+  MultiStream & operator<<(char const * x) { return each(x); }
+  MultiStream & operator<<(std::string const & x) { return each(x); }
+  MultiStream & operator<<(Code x) { return each(x); }
+  MultiStream & operator<<(int64_t x) { return each(x); }
+  MultiStream & operator<<(uint64_t x) { return each(x); }
+  MultiStream & operator<<(Raw<char> const & x) { return each(x); }
+
+ private:
+  template <typename T>
+  MultiStream & each(T const & x) {
+    auto live = active & ~*stopped;
+    for (std::size_t i = 0; i < lanes.size(); ++i) {
+      auto bit = std::uint64_t(1) << i;
+      if (live & bit) {
+        try {
+          lanes[i] << x;
+        } catch (LimitReached const &) {
+          *stopped |= bit;
+        }
       }
-      stream << c;
-      last = c;
-      fixup();
-      return *this;
     }
+    if (*stopped == all) {
+      throw LimitReached();
+    }
+    return *this;
+  }
 
-    void fixup() {
-      if (last == ',' && attr[TextAttribute::SPACE_AFTER_COMMA]) {
-        (*this) << ' ';
-        last = ' ';
+  template <typename F>
+  void select(TextAttribute a, bool value, F const & f) {
+    std::uint64_t mask = 0;
+    for (std::size_t i = 0; i < lanes.size(); ++i) {
+      if (lanes[i].attr[a] == value) {
+        mask |= std::uint64_t(1) << i;
       }
     }
+    mask &= active;
+    if (mask == active) {
+      f();
+    } else if (mask) {
+      auto saved = active;
+      active = mask;
+      f();
+      active = saved;
+    }
+  }
 
-    char last = ' ';
-  };
+  std::vector<Lane> lanes;
+  std::uint64_t all;
+  std::uint64_t active;
+  std::uint64_t * stopped;
+};
 
-  ConvStream stream;
+// Renders a symbol as text to a Stream, which is either a ConvStream for a single set of
+// attributes, or a MultiStream for several at once.
+template <typename Stream>
+class Converter {
+  Stream stream;
   DemangledType const & t;
   bool do_cconv = true;
   bool in_op_type = false;
 
   enum cv_context_t { BEFORE, AFTER };
 
+  // A non-owning reference to a callable that outputs a name in the middle of a type.  Unlike
+  // std::function, this never allocates, and the referenced callable must outlive it.
+  class NameFn {
+   public:
+    NameFn(std::nullptr_t = nullptr) {}
+    template <typename F>
+    NameFn(F const & f) : obj(&f), fn([](void const * o) { (*static_cast<F const *>(o))(); })
+    {}
+    explicit operator bool() const { return fn != nullptr; }
+    void operator()() const { fn(obj); }
+   private:
+    void const * obj = nullptr;
+    void (*fn)(void const *) = nullptr;
+  };
+
+  // The return type used for functions that don't have one
+  static DemangledType const & void_retval() {
+    static DemangledType const v("void");
+    return v;
+  }
+
  public:
-  Converter(TextAttributes const & a, std::ostream & s, DemangledType const & dt)
-    : stream(s, a), t(dt)
+  Converter(Stream s, DemangledType const & dt)
+    : stream(std::move(s)), t(dt), memo(&own_memo)
   {}
   void operator()();
+  void operator()(NameSpans & ns) {
+    spans = &ns;
+    (*this)();
+  }
 
   void class_name();
   void method_name();
   void method_signature();
 
+  void set_max_template_depth(std::size_t depth) {
+    max_template_depth_ = depth;
+  }
+  void set_dictionary(TextDictionary * dict) {
+    dictionary_ = dict;
+  }
+  void set_cache(TextCache const * cache) {
+    cache_ = cache;
+  }
+
  private:
+  // Sub-converters share the memo of the top-level converter
+  Converter(Stream s, DemangledType const & dt, Memo * m, std::size_t max_depth,
+            TextDictionary * dict, TextCache const * cache)
+    : stream(std::move(s)), t(dt), memo(m), max_template_depth_(max_depth), dictionary_(dict),
+      cache_(cache)
+  {}
   Converter sub(DemangledType const & dt) {
-    return Converter(stream.attr, stream.stream, dt);
+    return Converter(stream.sub(), dt, memo, max_template_depth_, dictionary_, cache_);
   }
   void do_name(DemangledType const & n);
+  void do_split_name();
   void do_name(FullyQualifiedName const & name);
   void do_name(FullyQualifiedName::const_reverse_iterator b,
                FullyQualifiedName::const_reverse_iterator e,
@@ -151,15 +614,60 @@ class Converter {
   void do_template_params(DemangledTemplate const & tmpl);
   void do_template_param(DemangledTemplateParameter const & param);
   void do_args(FunctionArgs const & args);
-  void do_type(DemangledType const & type, std::function<void()> name = nullptr);
-  void do_pointer(DemangledType const & ptr, std::function<void()> name = nullptr);
-  void do_function(DemangledType const & fn, std::function<void()> name = nullptr);
+  void do_type(DemangledType const & type, NameFn name = nullptr);
+  void do_shared_type(DemangledTypePtr const & type);
+  void do_pointer(DemangledType const & ptr, NameFn name = nullptr);
+  void do_function(DemangledType const & fn, NameFn name = nullptr);
   void do_storage_properties(DemangledType const & type, cv_context_t ctx);
   void do_method_properties(DemangledType const & m);
+  void do_clones();
   void output_quoted_string(std::string const & s);
 
   bool template_parameters_ = true;
+  // False while the class name of a constructor or destructor is output
+  bool abi_tags_ = true;
   DemangledType const * retval_ = nullptr;
+  Memo own_memo;
+  Memo * memo;
+  NameSpans * spans = nullptr;
+  // Template argument lists nested deeper than this are abbreviated (0 means no limit)
+  std::size_t max_template_depth_ = 0;
+  std::size_t template_depth_ = 0;
+  TextDictionary * dictionary_ = nullptr;
+  // The text of embedded symbols that have already been converted on their own, which is the
+  // same as the text that a sub-converter renders for them
+  TextCache const * cache_ = nullptr;
+
+  static bool has_template_arguments(DemangledType const & type) {
+    return std::any_of(type.name.begin(), type.name.end(), [](DemangledTypePtr const & n) {
+      return !n->template_parameters.empty(); });
+  }
+
+  // Whether a conversion operator appears anywhere within a type
+  static bool has_conversion(DemangledType const * type,
+                             std::unordered_set<DemangledType const *> & seen) {
+    if (!type || !seen.insert(type).second) {
+      return false;
+    }
+    auto any = [&seen](FullyQualifiedName const & names) {
+      return std::any_of(names.begin(), names.end(), [&seen](DemangledTypePtr const & n) {
+        return has_conversion(n.get(), seen); });
+    };
+    return type->simple_code == Code::OP_TYPE
+      || any(type->name) || any(type->com_interface) || any(type->instance_name)
+      || any(type->args) || has_conversion(type->inner_type.get(), seen)
+      || has_conversion(type->retval.get(), seen)
+      || has_conversion(type->enum_real_type.get(), seen)
+      || std::any_of(type->template_parameters.begin(), type->template_parameters.end(),
+                     [&seen](DemangledTemplateParameterPtr const & p) {
+                       return p && has_conversion(p->type.get(), seen); });
+  }
+
+  // The numeric values of a symbol whose demangling failed part way through (see
+  // visual_studio_demangle_partial()) may be incomplete, so access them defensively.
+  static int64_t nth(std::vector<int64_t> const & n, size_t i) {
+    return i < n.size() ? n[i] : 0;
+  }
 
   template <typename R, typename T>
   struct tset_impl {
@@ -180,28 +688,7 @@ class Converter {
 };
 
 template <typename Stream>
-Stream & operator<<(Stream & stream, Scope scope) {
-  switch (scope) {
-   case Scope::Unspecified: break;
-   case Scope::Private: stream << "private: "; break;
-   case Scope::Protected: stream << "protected: "; break;
-   case Scope::Public: stream << "public: "; break;
-  }
-  return stream;
-}
-
-template <typename Stream>
-Stream & operator<<(Stream & stream, Distance distance) {
-  switch (distance) {
-   case Distance::Unspecified: break;
-   case Distance::Near: stream << "near "; break;
-   case Distance::Far: stream << "far "; break;
-   case Distance::Huge: stream << "huge "; break;
-  }
-  return stream;
-}
-
-void Converter::output_quoted_string(std::string const & s)
+void Converter<Stream>::output_quoted_string(std::string const & s)
 {
   static std::string special_chars("\"\\\a\b\f\n\r\t\v\0", 10);
   static std::string names("\"\\abfnrtv0", 10);
@@ -217,15 +704,16 @@ void Converter::output_quoted_string(std::string const & s)
   stream << '\"';
 }
 
-void Converter::do_method_properties(DemangledType const & m)
+template <typename Stream>
+void Converter<Stream>::do_method_properties(DemangledType const & m)
 {
-  if (stream.attr[TextAttribute::OUTPUT_EXTERN] && m.extern_c) stream << "extern \"C\"";
-  if (stream.attr[TextAttribute::OUTPUT_THUNKS]
-      && m.method_property == MethodProperty::Thunk)
-  {
-    stream << "[thunk]: ";
+  if (m.extern_c) {
+    stream.when(TextAttribute::OUTPUT_EXTERN, [this] { stream << "extern \"C\""; });
   }
-  stream.operator<<(m.scope); // written this way due to operator lookup ambiguity
+  if (m.method_property == MethodProperty::Thunk) {
+    stream.when(TextAttribute::OUTPUT_THUNKS, [this] { stream << "[thunk]: "; });
+  }
+  stream << m.scope;
   if (m.method_property == MethodProperty::Static) stream << "static ";
   if (m.method_property == MethodProperty::Virtual
       // Thunks are virtual
@@ -237,14 +725,26 @@ void Converter::do_method_properties(DemangledType const & m)
   }
 }
 
-void Converter::operator()()
+template <typename Stream>
+void Converter<Stream>::operator()()
 {
+  if (t.is_imported) {
+    stream << "__declspec(dllimport) ";
+  }
+  if (t.transaction_clone) {
+    stream << "transaction clone for ";
+  } else if (t.non_transaction_clone) {
+    stream << "non-transaction clone for ";
+  }
+  if (spans) {
+    spans->prefix_end = stream.length();
+  }
   switch (t.symbol_type) {
    case SymbolType::ClassMethod:
    case SymbolType::GlobalFunction:
    case SymbolType::VtorDisp:
     // function-like
-    do_type(t,  [this] { do_name(t); });
+    do_type(t,  [this] { do_split_name(); });
     break;
    case SymbolType::RTTI:
     // RTTI
@@ -263,11 +763,9 @@ void Converter::operator()()
     do_method_properties(t);
     stream << t.calling_convention << ' ';
     do_name(t);
-    stream << '{' << t.n[0] << ",{flat}}'";
-    if (stream.attr[TextAttribute::BROKEN_UNDNAME]) {
-      // undname.exe ouputs an extra brace and quote
-      stream << " }'";
-    }
+    stream << '{' << nth(t.n, 0) << ",{flat}}'";
+    // undname.exe ouputs an extra brace and quote
+    stream.when(TextAttribute::BROKEN_UNDNAME, [this] { stream << " }'"; });
     break;
    case SymbolType::VTable:
     // vtables
@@ -291,29 +789,36 @@ void Converter::operator()()
    case SymbolType::StaticGuard:
     // Static variable guards
     do_name(t.name);
-    stream << '{' << t.n[0] << '}';
-    if (stream.attr[TextAttribute::BROKEN_UNDNAME]) {
+    // Itanium guard variables have no number
+    if (!t.n.empty()) {
+      stream << '{' << t.n[0] << '}';
       // undname.exe ouputs an extra quote
-      stream << '\'';
+      stream.when(TextAttribute::BROKEN_UNDNAME, [this] { stream << '\''; });
     }
     break;
    case SymbolType::String:
     // Constant string
-    if (!stream.attr[TextAttribute::VERBOSE_CONSTANT_STRING]) {
-      stream << "`string'";
-    } else {
+    stream.unless(TextAttribute::VERBOSE_CONSTANT_STRING, [this] { stream << "`string'"; });
+    stream.when(TextAttribute::VERBOSE_CONSTANT_STRING, [this] {
       do_type(*t.inner_type);
       stream << '[' << t.n[0] << "] = ";
       output_quoted_string(t.name[0]->simple_string);
       if (t.n[0] > 32) {
         stream << "...";
       }
-    }
+    });
     break;
    case SymbolType::HexSymbol:
     // Simple hex numbers
     stream << t.simple_string;
     break;
+   case SymbolType::DecoratedC:
+    // C names only have a calling convention if they are known to be functions
+    if (t.is_func) {
+      stream << t.calling_convention << ' ';
+    }
+    do_name(t.name);
+    break;
    case SymbolType::Unspecified:
     // Guess based on contents
     if (t.instance_name.empty()) {
@@ -323,15 +828,62 @@ void Converter::operator()()
     }
     break;
   }
+  do_clones();
+}
+
+template <typename Stream>
+void Converter<Stream>::do_clones()
+{
+  for (auto & clone : t.clones) {
+    stream << " [clone " << clone << ']';
+  }
 }
 
-void Converter::do_name(
+// Equivalent to do_name(t), but when recording spans, output the class and method names
+// separately so that their positions are known.
+template <typename Stream>
+void Converter<Stream>::do_split_name()
+{
+  auto & name = t.name;
+  bool splittable = Stream::records_spans && spans && !name.empty()
+                    && t.simple_code == Code::UNDEFINED && !t.inner_type
+                    && stream.previous() == ' '
+                    && std::none_of(name.begin(), name.end(), [](DemangledTypePtr const & n) {
+                        return n->simple_code == Code::DYNAMIC_ATEXIT_DTOR; });
+  if (splittable && name.size() > 1) {
+    // Within the text, a conversion operator anywhere in the class name would get the return
+    // type of the symbol, which it doesn't on its own
+    std::unordered_set<DemangledType const *> seen;
+    splittable = std::none_of(std::next(name.begin()), name.end(),
+                              [&seen](DemangledTypePtr const & n) {
+                                return has_conversion(n.get(), seen); });
+  }
+  if (!splittable) {
+    do_name(t);
+    return;
+  }
+  spans->split = true;
+  spans->name_begin = spans->class_end = stream.length();
+  if (name.size() > 1) {
+    do_name(name.rbegin(), std::prev(name.rend()));
+    spans->class_end = stream.length();
+    stream << "::";
+  }
+  spans->method_begin = stream.length();
+  spans->before_method = stream.previous();
+  do_name(name.rbegin(), name.rend(), true);
+  spans->method_end = stream.length();
+}
+
+template <typename Stream>
+void Converter<Stream>::do_name(
   FullyQualifiedName const & name)
 {
   do_name(name.rbegin(), name.rend());
 }
 
-void Converter::do_name(
+template <typename Stream>
+void Converter<Stream>::do_name(
   FullyQualifiedName::const_reverse_iterator b,
   FullyQualifiedName::const_reverse_iterator e,
   bool only_last)
@@ -352,7 +904,11 @@ void Converter::do_name(
     } else if (frag->is_embedded) {
       // Embedded symbols get `' around them
       stream << '`';
-      sub(*frag)();
+      if (cache_) {
+        stream.cached(*cache_, *frag, [this, &frag] { sub(*frag)(); });
+      } else {
+        sub(*frag)();
+      }
       stream << '\'';
     } else if (frag->is_ctor || frag->is_dtor) {
       // ctors and dtors need to get their name from the class name,
@@ -363,17 +919,22 @@ void Converter::do_name(
       if (i == b) {
         stream << "{ERRNOCLASS}";
       } else {
-        auto save = tset(template_parameters_,
-                         stream.attr[TextAttribute::CDTOR_CLASS_TEMPLATE_PARAMETERS]);
-        do_name(std::prev(i), i);
+        auto class_name = [this, i](bool params) {
+          auto save = tset(template_parameters_, params);
+          auto tags = tset(abi_tags_, false);
+          do_name(std::prev(i), i);
+        };
+        stream.when(TextAttribute::CDTOR_CLASS_TEMPLATE_PARAMETERS,
+                    [&class_name] { class_name(true); });
+        stream.unless(TextAttribute::CDTOR_CLASS_TEMPLATE_PARAMETERS,
+                      [&class_name] { class_name(false); });
       }
     } else if (frag->simple_code == Code::OP_TYPE) {
       // Where do we place template parameters in an operator type construct?  Microsoft does
       // it one way, the rest of the world does it another.
+      auto params = [this, &frag] { do_template_params(frag->template_parameters); };
       stream << "operator";
-      if (stream.attr[TextAttribute::USER_DEFINED_CONVERSION_TEMPLATE_BEFORE_TYPE]) {
-        do_template_params(frag->template_parameters);
-      }
+      stream.when(TextAttribute::USER_DEFINED_CONVERSION_TEMPLATE_BEFORE_TYPE, params);
       stream << ' ';
       if (retval_) {
         auto save = tset(in_op_type, true);
@@ -381,27 +942,31 @@ void Converter::do_name(
       } else {
         stream << "{UNKNOWN_TYPE}";
       }
-      if (stream.attr[TextAttribute::USER_DEFINED_CONVERSION_TEMPLATE_BEFORE_TYPE]) {
-        continue;
-      }
+      stream.unless(TextAttribute::USER_DEFINED_CONVERSION_TEMPLATE_BEFORE_TYPE, params);
+      continue;
     } else {
       // Normal case
       do_name(*frag);
+      if (abi_tags_) {
+        for (auto & tag : frag->abi_tags) {
+          stream << "[abi:" << tag << ']';
+        }
+      }
     }
     do_template_params(frag->template_parameters);
   }
 }
 
 
-void Converter::do_name(
+template <typename Stream>
+void Converter<Stream>::do_name(
   DemangledType const & name)
 {
   auto stype = [this, &name](char const * s) {
-    if (stream.attr[TextAttribute::MS_SIMPLE_TYPES]) {
-      stream << s;
-    } else {
-      stream << "std::" << code_string(name.simple_code);
-    }
+    stream.when(TextAttribute::MS_SIMPLE_TYPES, [this, s] { stream << s; });
+    stream.unless(TextAttribute::MS_SIMPLE_TYPES, [this, &name] {
+      stream << "std::" << name.simple_code;
+    });
   };
 
   switch (name.simple_code) {
@@ -409,8 +974,10 @@ void Converter::do_name(
     if (name.name.empty()) {
       if (name.is_anonymous) {
         stream << "`anonymous namespace";
-        if (stream.attr[TextAttribute::OUTPUT_ANONYMOUS_NUMBERS]) {
-          stream << ' ' << name.simple_string;
+        if (!name.simple_string.empty()) {
+          stream.when(TextAttribute::OUTPUT_ANONYMOUS_NUMBERS, [this, &name] {
+            stream << ' ' << name.simple_string;
+          });
         }
         stream << '\'';
       } else {
@@ -422,9 +989,9 @@ void Converter::do_name(
     break;
 
    case Code::CLASS: case Code::STRUCT: case Code::UNION: case Code::ENUM:
-    if (!stream.attr[TextAttribute::DISABLE_PREFIXES]) {
+    stream.unless(TextAttribute::DISABLE_PREFIXES, [this, &name] {
       stream << name.simple_code << ' ';
-    }
+    });
     do_name(name.name);
     break;
 
@@ -448,8 +1015,8 @@ void Converter::do_name(
 
    case Code::RTTI_BASE_CLASS_DESC:
     stream << "`RTTI Base Class Descriptor at ("
-           << name.n[0] << "," << name.n[1] << ","
-           << name.n[2] << "," << name.n[3] << ")'";
+           << nth(name.n, 0) << "," << nth(name.n, 1) << ","
+           << nth(name.n, 2) << "," << nth(name.n, 3) << ")'";
     break;
 
    default:
@@ -457,7 +1024,8 @@ void Converter::do_name(
   }
 }
 
-void Converter::do_template_param(
+template <typename Stream>
+void Converter<Stream>::do_template_param(
   DemangledTemplateParameter const & p)
 {
   if (!p.type) {
@@ -475,14 +1043,21 @@ void Converter::do_template_param(
       sub(*p.type)();
     }
   } else {
-    do_type(*p.type);
+    do_shared_type(p.type);
   }
 }
 
-void Converter::do_template_params(
+template <typename Stream>
+void Converter<Stream>::do_template_params(
   DemangledTemplate const & tmpl)
 {
   if (template_parameters_ && !tmpl.empty()) {
+    if (max_template_depth_ && template_depth_ >= max_template_depth_) {
+      stream << '<' << "..." << '>';
+      return;
+    }
+    auto depth = tset(template_depth_, template_depth_ + 1);
+    auto tags = tset(abi_tags_, true);
     stream << '<';
     bool first = true;
     for (auto & tp : tmpl) {
@@ -499,7 +1074,8 @@ void Converter::do_template_params(
   }
 }
 
-void Converter::do_args(
+template <typename Stream>
+void Converter<Stream>::do_args(
   FunctionArgs const & args)
 {
   stream << '(';
@@ -509,23 +1085,40 @@ void Converter::do_args(
     if (i != b) {
       stream << ',';
     }
-    do_type(**i);
+    do_shared_type(*i);
   }
   stream << ')';
 }
 
-void Converter::do_pointer(
+// Back-references make the same node show up repeatedly within a symbol, so the text of a
+// shared node is rendered once and spliced in on repeats.
+template <typename Stream>
+void Converter<Stream>::do_shared_type(
+  DemangledTypePtr const & type)
+{
+  if (type.use_count() < 2 || dictionary_) {
+    // With a dictionary, the text also depends on what has been aliased so far
+    do_type(*type);
+    return;
+  }
+  auto state = Memo::State(type.get(), retval_, template_parameters_, in_op_type, do_cconv,
+                           template_depth_);
+  stream.shared(*memo, state, [this, &type] { do_type(*type); });
+}
+
+template <typename Stream>
+void Converter<Stream>::do_pointer(
   DemangledType const & type,
-  std::function<void()> name)
+  NameFn name)
 {
-  auto iname = [this, &name, &type]() {
-    auto & inner = *type.inner_type;
-    bool parens = inner.is_func || inner.is_array;
+  auto iname = [this, name, &type]() {
+    auto inner = type.inner_type.get();
+    bool parens = inner && (inner->is_func || inner->is_array);
     stream << (parens ? '(' : ' ');
-    if (inner.is_func) {
-      stream << inner.calling_convention << ' ';
+    if (parens && inner->is_func && !inner->calling_convention.empty()) {
+      stream << inner->calling_convention << ' ';
     }
-    if (inner.is_member && !type.name.empty()) {
+    if (inner && inner->is_member && !type.name.empty()) {
       // Method or member pointer
       do_name(type);
       stream << "::";
@@ -538,7 +1131,11 @@ void Converter::do_pointer(
     if (name) name();
     if (parens) stream << ')';
   };
-  if (type.inner_type->is_func) {
+  if (!type.inner_type) {
+    // Only a partial symbol can be missing the pointed to type
+    stream << "{UNKNOWN_TYPE}";
+    iname();
+  } else if (type.inner_type->is_func) {
     auto save = tset(do_cconv, false);
     do_type(*type.inner_type, iname);
   } else {
@@ -546,24 +1143,28 @@ void Converter::do_pointer(
   }
 }
 
-void Converter::do_type(
+template <typename Stream>
+void Converter<Stream>::do_type(
   DemangledType const & type,
-  std::function<void()> name)
+  NameFn name)
 {
   do_method_properties(type);
-  if (type.distance != Distance::Near || stream.attr[TextAttribute::OUTPUT_NEAR]) {
-    stream.operator<<(type.distance); // written this way due to operator lookup ambiguity
+  if (type.distance != Distance::Near) {
+    stream << type.distance;
+  } else {
+    stream.when(TextAttribute::OUTPUT_NEAR, [this, &type] { stream << type.distance; });
   }
-  auto pname = name;
-  if (type.is_array) {
-    auto aname = [this, &type, name]() {
-      if (name) name();
-      for (auto dim : type.dimensions) {
-        stream << '[' << dim << ']';
+  auto aname = [this, &type, name]() {
+    if (name) name();
+    for (auto dim : type.dimensions) {
+      stream << '[';
+      if (dim != DemangledType::unbounded_dimension) {
+        stream << dim;
       }
-    };
-    pname = aname;
-  }
+      stream << ']';
+    }
+  };
+  auto pname = type.is_array ? NameFn(aname) : name;
   if (type.is_func) {
     do_function(type.inner_type ? *type.inner_type : type, pname);
     return;
@@ -572,16 +1173,21 @@ void Converter::do_type(
     do_pointer(type, pname);
     return;
   }
-  do_name(type);
+  if (dictionary_ && has_template_arguments(type)) {
+    stream.aliased(*dictionary_, [this, &type] { do_name(type); });
+  } else {
+    do_name(type);
+  }
   do_storage_properties(type, BEFORE);
   if (pname) {
     pname();
   }
 }
 
-void Converter::do_function(
+template <typename Stream>
+void Converter<Stream>::do_function(
   DemangledType const & fn,
-  std::function<void()> name)
+  NameFn name)
 {
   auto cconv = do_cconv;
   auto fname = [this, &fn, name, cconv]() {
@@ -592,7 +1198,7 @@ void Converter::do_function(
       }
       if (name) name();
       if (fn.symbol_type == SymbolType::VtorDisp) {
-        stream << "`vtordisp{" << fn.n[0] << ',' << fn.n[1] << "}' ";
+        stream << "`vtordisp{" << nth(fn.n, 0) << ',' << nth(fn.n, 1) << "}' ";
       } else if (fn.method_property == MethodProperty::Thunk && fn.n.size() >= 2) {
         stream << "`adjustor{" << fn.n[1] << "}' ";
       }
@@ -600,11 +1206,7 @@ void Converter::do_function(
       do_storage_properties(fn, AFTER);
     }
   };
-  auto rv = fn.retval;
-  if (!rv) {
-    rv.reset(new DemangledType("void"));
-  }
-  auto save = tset(retval_, rv.get());
+  auto save = tset(retval_, fn.retval ? fn.retval.get() : &void_retval());
   auto save2 = tset(do_cconv, true);
   if (!fn.name.empty() && fn.name.front()->simple_code == Code::OP_TYPE) {
     // operator <type>
@@ -614,12 +1216,12 @@ void Converter::do_function(
   }
 }
 
-void Converter::do_storage_properties(
+template <typename Stream>
+void Converter<Stream>::do_storage_properties(
   DemangledType const & type, cv_context_t ctx)
 {
   bool is_retval = retval_ == &type;
-  bool discard = stream.attr[TextAttribute::DISCARD_CV_ON_RETURN_POINTER]
-                 && type.is_pointer && is_retval && !in_op_type;
+  bool may_discard = type.is_pointer && is_retval && !in_op_type;
   char const * a = (ctx == BEFORE) ? " " : "";
   char const * b = (ctx == AFTER) ? " " : "";
 
@@ -627,83 +1229,350 @@ void Converter::do_storage_properties(
     if (type.is_const) stream << a << "const" << b;
     if (type.is_volatile) stream << a << "volatile" << b;
   };
+  auto keep_cv = [this, &cv, may_discard]() {
+    if (may_discard) {
+      stream.unless(TextAttribute::DISCARD_CV_ON_RETURN_POINTER, cv);
+    } else {
+      cv();
+    }
+  };
 
-  if (!discard && ctx == AFTER) cv();
-  if (type.unaligned && stream.attr[TextAttribute::MS_QUALIFIERS]) {
-    stream << a << "__unaligned" << b;
+  if (ctx == AFTER) keep_cv();
+  if (type.unaligned) {
+    stream.when(TextAttribute::MS_QUALIFIERS, [this, a, b] {
+      stream << a << "__unaligned" << b;
+    });
   }
   if (type.is_pointer) stream << a << (type.is_gc ? '^' : '*') << b;
   if (type.is_reference) stream << a << (type.is_gc ? '%' : '&') << b;
   if (type.is_refref) stream << a << "&&" << b;
-  if (type.ptr64 && stream.attr[TextAttribute::OUTPUT_PTR64]) stream << a << "__ptr64" << b;
-  if (type.restrict && stream.attr[TextAttribute::MS_QUALIFIERS]) {
-    stream << a << "__restrict" << b;
+  if (type.ptr64) {
+    stream.when(TextAttribute::OUTPUT_PTR64, [this, a, b] { stream << a << "__ptr64" << b; });
+  }
+  if (type.restrict) {
+    stream.when(TextAttribute::MS_QUALIFIERS, [this, a, b] {
+      stream << a << "__restrict" << b;
+    });
   }
-  if (!discard && ctx == BEFORE) cv();
+  if (ctx == BEFORE) keep_cv();
 }
 
-void Converter::class_name()
+template <typename Stream>
+void Converter<Stream>::class_name()
 {
   if (!t.name.empty()) {
     do_name(t.name.rbegin(), std::prev(t.name.rend()));
   }
 }
 
-void Converter::method_name()
+template <typename Stream>
+void Converter<Stream>::method_name()
 {
   if (!t.name.empty()) {
-    auto rv = t.retval;
-    if (!rv) {
-      rv.reset(new DemangledType("void"));
-    }
-    auto save = tset(retval_, rv.get());
+    auto save = tset(retval_, t.retval ? t.retval.get() : &void_retval());
     do_name(t.name.rbegin(), t.name.rend(), true);
   }
 }
 
-void Converter::method_signature()
+template <typename Stream>
+void Converter<Stream>::method_signature()
+{
+  auto save = tset(retval_, t.retval ? t.retval.get() : &void_retval());
+  auto mname = [this] { method_name(); };
+  do_type(t, mname);
+  do_clones();
+}
+
+enum class Part { TEXT, CLASS_NAME, METHOD_NAME, METHOD_SIGNATURE };
+
+template <typename Attributes>
+void render_as(Attributes const & attr, TextOutput const & options, TextSink & sink,
+               DemangledType const & sym, Part part, NameSpans * spans,
+               TextCache const * cache)
+{
+  Converter<ConvStream<Attributes>> conv(ConvStream<Attributes>(sink, attr), sym);
+  conv.set_max_template_depth(options.get_max_template_depth());
+  conv.set_dictionary(options.get_dictionary());
+  conv.set_cache(cache);
+  switch (part) {
+   case Part::TEXT:
+    if (spans) {
+      conv(*spans);
+    } else {
+      conv();
+    }
+    break;
+   case Part::CLASS_NAME: conv.class_name(); break;
+   case Part::METHOD_NAME: conv.method_name(); break;
+   case Part::METHOD_SIGNATURE: conv.method_signature(); break;
+  }
+}
+
+// Limit the sink to the maximum length or the output budget, whichever applies.  Returns
+// whether reaching the limit means exceeding the budget, rather than abbreviating the text.
+bool limit_sink(TextOutput const & options, TextSink & sink)
+{
+  auto max_length = options.get_max_length();
+  auto max_output = options.get_max_output();
+  // Abbreviated text never exceeds a budget that is at least the maximum length
+  bool over_budget = max_output && (!max_length || max_output < max_length);
+  if (over_budget) {
+    sink.set_limit(max_output);
+  } else if (max_length) {
+    sink.set_limit(max_length);
+  }
+  return over_budget;
+}
+
+// Once the sink has reached its limit, abbreviate its text, or if the limit is the output
+// budget, remove the text and throw an OutputBudgetExceeded
+void limit_reached(TextOutput const & options, TextSink & sink, bool over_budget)
 {
-  auto rv = t.retval;
-  if (!rv) {
-    rv.reset(new DemangledType("void"));
+  if (over_budget) {
+    sink.discard();
+    throw OutputBudgetExceeded("Demangled text exceeds the output budget of "
+                               + std::to_string(options.get_max_output()) + " characters");
+  }
+  sink.abbreviate();
+}
+
+// Render using a converter specialized for the attributes when they match a preset.  Returns
+// false if the text was abbreviated because it reached the maximum length, and throws an
+// OutputBudgetExceeded if it would exceed the output budget.
+bool render(TextOutput const & options, TextSink & sink, DemangledType const & sym,
+            Part part = Part::TEXT, NameSpans * spans = nullptr,
+            TextCache const * cache = nullptr)
+{
+  auto & attr = options.get_attributes();
+  bool over_budget = limit_sink(options, sink);
+  try {
+    switch (attr.value()) {
+     case TextAttributes::pretty_value:
+      render_as(FixedAttributes<TextAttributes::pretty_value>(), options, sink, sym, part,
+                spans, cache);
+      break;
+     case TextAttributes::undname_value:
+      render_as(FixedAttributes<TextAttributes::undname_value>(), options, sink, sym, part,
+                spans, cache);
+      break;
+     default:
+      render_as(attr, options, sink, sym, part, spans, cache);
+    }
+  } catch (LimitReached const &) {
+    limit_reached(options, sink, over_budget);
+    return false;
+  }
+  return true;
+}
+
+// Render the text for each of up to MultiStream::max_lanes sets of attributes into the
+// corresponding sink in one walk, with the same limits as render()
+void render_multiple(TextOutput const & options, TextAttributes const * attrs,
+                     TextSink * sinks, std::size_t n, DemangledType const & sym)
+{
+  std::vector<MultiStream::Lane> lanes;
+  lanes.reserve(n);
+  std::uint64_t over_budget = 0;
+  for (std::size_t i = 0; i < n; ++i) {
+    if (limit_sink(options, sinks[i])) {
+      over_budget |= std::uint64_t(1) << i;
+    }
+    lanes.emplace_back(sinks[i], attrs[i]);
+  }
+  std::uint64_t stopped = 0;
+  Converter<MultiStream> conv(MultiStream(std::move(lanes), stopped), sym);
+  conv.set_max_template_depth(options.get_max_template_depth());
+  conv.set_dictionary(options.get_dictionary());
+  try {
+    conv();
+  } catch (LimitReached const &) {
+    // Every lane has stopped
+  }
+  for (std::size_t i = 0; i < n; ++i) {
+    auto bit = std::uint64_t(1) << i;
+    if (stopped & bit) {
+      limit_reached(options, sinks[i], over_budget & bit);
+    }
   }
-  auto save = tset(retval_, rv.get());
-  do_type(t, [this] { method_name(); });
 }
 
 } // namespace detail
 
+std::string const * TextDictionary::lookup(std::string const & text)
+{
+  if (text.size() < min_length) {
+    return nullptr;
+  }
+  auto & entry = index[text];
+  if (entry.alias) {
+    return &aliases[entry.alias - 1].first;
+  }
+  if (++entry.uses < min_uses) {
+    return nullptr;
+  }
+  aliases.emplace_back("{#" + std::to_string(aliases.size() + 1) + '}', text);
+  entry.alias = aliases.size();
+  return &aliases.back().first;
+}
+
+std::vector<std::string> TextOutput::convert_multiple(
+  std::vector<TextAttributes> const & attrs, DemangledType const & sym) const
+{
+  using detail::MultiStream;
+  std::vector<std::string> result(attrs.size());
+  std::vector<detail::TextSink> sinks;
+  sinks.reserve(attrs.size());
+  for (auto & s : result) {
+    sinks.emplace_back(s);
+  }
+  for (std::size_t first = 0; first < attrs.size(); first += MultiStream::max_lanes) {
+    auto last = std::min(attrs.size(), first + MultiStream::max_lanes);
+    detail::render_multiple(*this, &attrs[first], &sinks[first], last - first, sym);
+  }
+  return result;
+}
+
 std::string TextOutput::convert(DemangledType const & sym) const
 {
-  std::ostringstream os;
-  convert(os, sym);
-  return os.str();
+  std::string s;
+  append(s, sym);
+  return s;
+}
+
+std::string TextOutput::convert(DemangledType const & sym, TextCache & cache) const
+{
+  if (dictionary) {
+    return convert(sym);
+  }
+  auto found = cache.find(sym);
+  if (found) {
+    return *found;
+  }
+  std::string s;
+  detail::TextSink sink(s);
+  if (detail::render(*this, sink, sym, detail::Part::TEXT, nullptr, &cache)) {
+    // Abbreviated text can't be spliced into longer text
+    cache.entries.emplace(&sym, s);
+  }
+  return s;
+}
+
+std::size_t TextOutput::convert(char * buf, std::size_t cap, DemangledType const & sym) const
+{
+  // Leave room for the terminating NUL
+  detail::TextSink sink(buf, cap ? cap - 1 : 0);
+  detail::render(*this, sink, sym);
+  if (cap) {
+    buf[std::min(sink.length(), cap - 1)] = '\0';
+  }
+  return sink.length();
+}
+
+void TextOutput::components(DemangledType const & sym, TextComponents & c) const
+{
+  using Span = TextComponents::Span;
+  c.buffer.clear();
+  c.args.clear();
+  // Each part gets its own sink, so that each is limited to the maximum length separately
+  auto render = [this, &c](DemangledType const & t, detail::Part part,
+                           detail::NameSpans * spans) {
+    auto begin = c.buffer.size();
+    detail::TextSink sink(c.buffer);
+    bool complete = detail::render(*this, sink, t, part, spans);
+    if (spans) {
+      spans->split &= complete;
+    }
+    return Span{begin, sink.length()};
+  };
+
+  detail::NameSpans ns;
+  c.text = render(sym, detail::Part::TEXT, &ns);
+
+  if (ns.split) {
+    c.class_name = Span{ns.name_begin, ns.class_end - ns.name_begin};
+    // The class name must read the same as on its own.  (Rendering it again would add to a
+    // dictionary.)
+    assert(dictionary || c.str(c.class_name) == get_class_name(sym));
+    c.method_name = Span{ns.method_begin, ns.method_end - ns.method_begin};
+    if (ns.before_method != ' ' && c.method_name.length && c.buffer[ns.method_begin] == ' ') {
+      // On its own, the method name would have been rendered without its leading space
+      ++c.method_name.offset;
+      --c.method_name.length;
+    }
+    // The signature is the text with the method name in place of the fully qualified name
+    auto begin = c.buffer.size();
+    c.buffer.reserve(begin + (ns.name_begin - ns.prefix_end) + c.method_name.length
+                     + (begin - ns.method_end));
+    c.buffer.append(c.buffer, ns.prefix_end, ns.name_begin - ns.prefix_end);
+    c.buffer.append(c.buffer, c.method_name.offset, c.method_name.length);
+    c.buffer.append(c.buffer, ns.method_end, begin - ns.method_end);
+    c.signature = Span{begin, c.buffer.size() - begin};
+  } else {
+    c.class_name = render(sym, detail::Part::CLASS_NAME, nullptr);
+    c.method_name = render(sym, detail::Part::METHOD_NAME, nullptr);
+    c.signature = render(sym, detail::Part::METHOD_SIGNATURE, nullptr);
+  }
+
+  // The return and argument types are rendered on their own, as their text within the symbol
+  // depends on their context.
+  c.return_type = Span{c.buffer.size(), 0};
+  if (sym.retval) {
+    c.return_type = render(*sym.retval, detail::Part::TEXT, nullptr);
+  }
+  for (auto & arg : sym.args) {
+    c.args.push_back(render(*arg, detail::Part::TEXT, nullptr));
+  }
+}
+
+TextComponents TextOutput::components(DemangledType const & sym) const
+{
+  TextComponents c;
+  components(sym, c);
+  return c;
+}
+
+std::size_t TextOutput::length(DemangledType const & sym) const
+{
+  detail::TextSink sink;
+  detail::render(*this, sink, sym);
+  return sink.length();
+}
+
+std::string & TextOutput::append(std::string & s, DemangledType const & sym) const
+{
+  detail::TextSink sink(s);
+  detail::render(*this, sink, sym);
+  return s;
 }
 
 void TextOutput::convert_(std::ostream & stream, DemangledType const & sym) const
 {
-  detail::Converter(attr, stream, sym)();
+  auto s = convert(sym);
+  stream.write(s.data(), std::streamsize(s.size()));
 }
 
 std::string TextOutput::get_class_name(DemangledType const & sym) const
 {
-  std::ostringstream os;
-  detail::Converter(attr, os, sym).class_name();
-  return os.str();
+  std::string s;
+  detail::TextSink sink(s);
+  detail::render(*this, sink, sym, detail::Part::CLASS_NAME);
+  return s;
 }
 
 std::string TextOutput::get_method_name(DemangledType const & sym) const
 {
-  std::ostringstream os;
-  detail::Converter(attr, os, sym).method_name();
-  return os.str();
+  std::string s;
+  detail::TextSink sink(s);
+  detail::render(*this, sink, sym, detail::Part::METHOD_NAME);
+  return s;
 }
 
 std::string TextOutput::get_method_signature(DemangledType const & sym) const
 {
-  std::ostringstream os;
-  detail::Converter(attr, os, sym).method_signature();
-  return os.str();
+  std::string s;
+  detail::TextSink sink(s);
+  detail::render(*this, sink, sym, detail::Part::METHOD_SIGNATURE);
+  return s;
 }
 
 std::vector<std::pair<const TextAttribute, const std::string>> const &
@@ -26,6 +26,8 @@
 
 #include "demangle.hpp"
 #include <ostream>              // std::ostream
+#include <map>                  // std::map
+#include <unordered_map>        // std::unordered_map
 
 namespace demangle {
 
@@ -81,28 +83,36 @@ class TextAttributes {
     return val & static_cast<decltype(val)>(a);
   }
 
+  std::uint32_t value() const {
+    return val;
+  }
+
+  // The values of the presets below.  These are constants so that the text renderer can be
+  // specialized for them.
+  static constexpr std::uint32_t undname_value =
+    std::uint32_t(TextAttribute::OUTPUT_EXTERN)
+    | std::uint32_t(TextAttribute::OUTPUT_THUNKS)
+    | std::uint32_t(TextAttribute::CDTOR_CLASS_TEMPLATE_PARAMETERS)
+    | std::uint32_t(TextAttribute::MS_SIMPLE_TYPES)
+    | std::uint32_t(TextAttribute::SPACE_BETWEEN_TEMPLATE_BRACKETS)
+    | std::uint32_t(TextAttribute::USER_DEFINED_CONVERSION_TEMPLATE_BEFORE_TYPE)
+    | std::uint32_t(TextAttribute::DISCARD_CV_ON_RETURN_POINTER)
+    | std::uint32_t(TextAttribute::MS_QUALIFIERS)
+    | std::uint32_t(TextAttribute::OUTPUT_PTR64);
+
+  static constexpr std::uint32_t pretty_value =
+    std::uint32_t(TextAttribute::OUTPUT_THUNKS)
+    | std::uint32_t(TextAttribute::SPACE_BETWEEN_TEMPLATE_BRACKETS)
+    | std::uint32_t(TextAttribute::VERBOSE_CONSTANT_STRING)
+    | std::uint32_t(TextAttribute::SPACE_AFTER_COMMA)
+    | std::uint32_t(TextAttribute::OUTPUT_ANONYMOUS_NUMBERS);
+
   static TextAttributes undname() {
-    auto attr = TextAttributes();
-    attr.set(TextAttribute::OUTPUT_EXTERN);
-    attr.set(TextAttribute::OUTPUT_THUNKS);
-    attr.set(TextAttribute::CDTOR_CLASS_TEMPLATE_PARAMETERS);
-    attr.set(TextAttribute::MS_SIMPLE_TYPES);
-    attr.set(TextAttribute::SPACE_BETWEEN_TEMPLATE_BRACKETS);
-    attr.set(TextAttribute::USER_DEFINED_CONVERSION_TEMPLATE_BEFORE_TYPE);
-    attr.set(TextAttribute::DISCARD_CV_ON_RETURN_POINTER);
-    attr.set(TextAttribute::MS_QUALIFIERS);
-    attr.set(TextAttribute::OUTPUT_PTR64);
-    return attr;
+    return TextAttributes(undname_value);
   };
 
   static TextAttributes pretty() {
-    auto attr =  TextAttributes();
-    attr.set(TextAttribute::OUTPUT_THUNKS);
-    attr.set(TextAttribute::SPACE_BETWEEN_TEMPLATE_BRACKETS);
-    attr.set(TextAttribute::VERBOSE_CONSTANT_STRING);
-    attr.set(TextAttribute::SPACE_AFTER_COMMA);
-    attr.set(TextAttribute::OUTPUT_ANONYMOUS_NUMBERS);
-    return attr;
+    return TextAttributes(pretty_value);
   };
 
   static std::vector<std::pair<const TextAttribute, const std::string>> const &
@@ -113,6 +123,85 @@ class TextAttributes {
 };
 
 
+// The text of a symbol along with its parts, as produced by TextOutput::components().  All of
+// the strings live back to back in one buffer, and are referred to by spans into it.
+struct TextComponents {
+  struct Span {
+    std::size_t offset;
+    std::size_t length;
+  };
+
+  std::string buffer;
+  Span text = Span{0, 0};
+  Span class_name = Span{0, 0};
+  Span method_name = Span{0, 0};
+  Span signature = Span{0, 0};
+  Span return_type = Span{0, 0};
+  std::vector<Span> args;
+
+  char const * data(Span s) const {
+    return buffer.data() + s.offset;
+  }
+  std::string str(Span s) const {
+    return buffer.substr(s.offset, s.length);
+  }
+};
+
+// Short aliases for the text of template types that are rendered repeatedly, shared by the
+// TextOutputs that it is given to (see TextOutput::set_dictionary()).  Once the same text has
+// been seen min_uses times, it is assigned the next alias ("{#1}", "{#2}", ...), which is
+// output in its place from then on.  Demangled text never contains "{#", so an alias can't be
+// mistaken for text such as the "#1" of an Itanium "{lambda()#1}".  Text shorter than
+// min_length is never aliased.  The text of an alias can contain earlier aliases.
+class TextDictionary {
+ public:
+  TextDictionary(std::size_t min_length_ = 24, unsigned min_uses_ = 2)
+    : min_length(min_length_), min_uses(min_uses_)
+  {}
+
+  // Record a use of the text, and return its alias, or nullptr if it doesn't have one
+  std::string const * lookup(std::string const & text);
+
+  // The (alias, text) pairs, in the order that they were assigned
+  std::vector<std::pair<std::string, std::string>> const & entries() const {
+    return aliases;
+  }
+
+ private:
+  struct Entry {
+    unsigned uses = 0;
+    std::size_t alias = 0;      // index into aliases, plus one
+  };
+
+  std::size_t min_length;
+  unsigned min_uses;
+  std::map<std::string, Entry> index;
+  std::vector<std::pair<std::string, std::string>> aliases;
+};
+
+// The text of the symbols converted with it (see TextOutput::convert()), so that the text of a
+// symbol that embeds them is made by splicing theirs in rather than rendering them again.  A
+// cache is only good for the TextOutput that filled it, and must not outlive its symbols.
+class TextCache {
+ public:
+  // The text of a symbol, or nullptr if it hasn't been converted
+  std::string const * find(DemangledType const & sym) const {
+    auto found = entries.find(&sym);
+    return found == entries.end() ? nullptr : &found->second;
+  }
+
+ private:
+  friend class TextOutput;
+  std::unordered_map<DemangledType const *, std::string> entries;
+};
+
+// The Error thrown for output that would exceed the output budget (see
+// TextOutput::set_max_output()), so that it can be told apart from other errors
+class OutputBudgetExceeded : public Error {
+ public:
+  using Error::Error;
+};
+
 class TextOutput {
  public:
   TextOutput() = default;
@@ -120,9 +209,75 @@ class TextOutput {
 
   std::string convert(DemangledType const & sym) const;
 
+  // Output symbol as text, reusing the text in a cache for the symbol or the symbols embedded
+  // in it, and adding the text to the cache.  Converting a symbol and then each of the
+  // symbols that contain it this way renders each only once.  The cache isn't used with a
+  // dictionary, since the aliases depend on the order that text is rendered in.
+  std::string convert(DemangledType const & sym, TextCache & cache) const;
+
+  // Output symbol as text into a caller-provided buffer of cap bytes, which is always
+  // NUL-terminated when cap is non-zero.  Like snprintf(), returns the full length of the text,
+  // not counting the NUL, so a result >= cap means that the output was truncated.
+  std::size_t convert(char * buf, std::size_t cap, DemangledType const & sym) const;
+
+  // Output symbol as text once for each of several sets of attributes, in place of this
+  // output's own, with its other settings applied to each.  The symbol is walked only once,
+  // and output that doesn't depend on the attributes is shared between them.  Like convert(),
+  // throws an OutputBudgetExceeded if any of the text would exceed the output budget.
+  std::vector<std::string> convert_multiple(std::vector<TextAttributes> const & attrs,
+                                            DemangledType const & sym) const;
+
+  // The exact length of the text for a symbol, without rendering it anywhere
+  std::size_t length(DemangledType const & sym) const;
+
+  // Append the text for a symbol to an existing string, reusing its capacity
+  std::string & append(std::string & s, DemangledType const & sym) const;
+
   void set_attributes(TextAttributes a) {
     attr = a;
   }
+  TextAttributes const & get_attributes() const {
+    return attr;
+  }
+
+  // Stop rendering once the text reaches this many characters, ending it with "..." instead.
+  // Zero means no limit.
+  void set_max_length(std::size_t n) {
+    max_length = n;
+  }
+  std::size_t get_max_length() const {
+    return max_length;
+  }
+
+  // Throw an OutputBudgetExceeded rather than produce more than this many characters of text
+  // for a symbol, which a small mangled symbol can do by repeatedly referring back to a large
+  // type.  The check is made as the text is written, so rendering stops as soon as the budget
+  // runs out.  Each of the strings from components() is checked separately.  Zero means no
+  // budget.
+  void set_max_output(std::size_t n) {
+    max_output = n;
+  }
+  std::size_t get_max_output() const {
+    return max_output;
+  }
+
+  // Abbreviate template argument lists nested deeper than this as "<...>".  Zero means no
+  // limit.
+  void set_max_template_depth(std::size_t n) {
+    max_template_depth = n;
+  }
+  std::size_t get_max_template_depth() const {
+    return max_template_depth;
+  }
+
+  // Use the aliases from a dictionary for repeated template types.  The dictionary is not
+  // owned, and may be shared with other outputs.  Null means no aliases.
+  void set_dictionary(TextDictionary * dict) {
+    dictionary = dict;
+  }
+  TextDictionary * get_dictionary() const {
+    return dictionary;
+  }
 
   // Output symbol as text to stream
   template <typename OStream>
@@ -137,6 +292,12 @@ class TextOutput {
     return convert(stream, sym);
   }
 
+  // Get the full text, class name, method name, signature, return type, and argument types
+  // together.  The symbol is walked once for the first four.  The second form reuses the
+  // buffer of an existing TextComponents.
+  TextComponents components(DemangledType const & sym) const;
+  void components(DemangledType const & sym, TextComponents & c) const;
+
   // Get just the class name
   std::string get_class_name(DemangledType const & sym) const;
   // Get just the method name, without the class or arguments
@@ -166,6 +327,10 @@ class TextOutput {
   void convert_(std::ostream & stream, DemangledType const & sym) const;
 
   TextAttributes attr;
+  std::size_t max_length = 0;
+  std::size_t max_output = 0;
+  std::size_t max_template_depth = 0;
+  TextDictionary * dictionary = nullptr;
 };
 
 template <typename OStream>
@@ -0,0 +1,1519 @@
+// Pharos Demangler
+//
+// Copyright 2017-2020 Carnegie Mellon University. All Rights Reserved.
+//
+// NO WARRANTY. THIS CARNEGIE MELLON UNIVERSITY AND SOFTWARE ENGINEERING
+// INSTITUTE MATERIAL IS FURNISHED ON AN "AS-IS" BASIS. CARNEGIE MELLON
+// UNIVERSITY MAKES NO WARRANTIES OF ANY KIND, EITHER EXPRESSED OR
+// IMPLIED, AS TO ANY MATTER INCLUDING, BUT NOT LIMITED TO, WARRANTY OF
+// FITNESS FOR PURPOSE OR MERCHANTABILITY, EXCLUSIVITY, OR RESULTS
+// OBTAINED FROM USE OF THE MATERIAL. CARNEGIE MELLON UNIVERSITY DOES NOT
+// MAKE ANY WARRANTY OF ANY KIND WITH RESPECT TO FREEDOM FROM PATENT,
+// TRADEMARK, OR COPYRIGHT INFRINGEMENT.
+//
+// Released under a BSD-style license, please see license.txt or contact
+// permission@sei.cmu.edu for full terms.
+//
+// [DISTRIBUTION STATEMENT A] This material has been approved for public
+// release and unlimited distribution.  Please see Copyright notice for
+// non-US Government use and distribution.
+//
+// DM17-0949
+
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <unordered_map>
+#include <utility>
+#include <boost/format.hpp>
+
+#include "demangle.hpp"
+#include "demangle_text.hpp"
+
+namespace demangle {
+namespace detail {
+
+// A demangler for the Itanium C++ ABI mangling used by GCC, Clang, MinGW and most other
+// non-Microsoft compilers.  See https://itanium-cxx-abi.github.io/cxx-abi/abi.html#mangling
+//
+// The results are the same DemangledType trees produced by the VisualStudioDemangler, so
+// fully qualified names are stored innermost first, and the Itanium special names (vtables,
+// typeinfo, guard variables, thunks) are mapped onto their closest Visual Studio equivalents.
+// Only the simplest expressions (literals, template parameters and the addresses of external
+// names) are supported as template arguments, and decltype() types are not supported at all.
+class ItaniumDemangler
+{
+ private:
+  char const * mangled;
+  size_t length;
+  bool debug;
+  size_t offset;
+  std::string error;
+
+  // Substitution candidates, referred to by S_, S0_, S1_, ...  Unlike the Visual Studio
+  // reference stacks, these are unlimited in size and never reset within a symbol.
+  ReferenceStack substitutions;
+
+  // The substitution candidates that are template parameters, with the offset of each one.
+  // Those read in a nested encoding are in nested_params, since they refer to the template
+  // arguments where they're used, and so are read again there.
+  std::vector<std::pair<size_t, size_t>> param_substitutions;
+  std::unordered_map<size_t, size_t> nested_params;
+
+  // The template arguments of one template parameter.  Parameter packs have any number of
+  // arguments, every other parameter exactly one.
+  struct TemplateArgs {
+    DemangledTemplate args;
+    bool pack = false;
+  };
+
+  // The template arguments that template parameters (T_, T0_, T1_, ...) refer to.
+  std::vector<TemplateArgs> template_args;
+
+  // While reading the pattern of a pack expansion, the size of the first parameter pack
+  // referred to, and the index of the argument of the pack to use.
+  static constexpr size_t no_pack = size_t(-1);
+  size_t pack_size = no_pack;
+  size_t pack_index = no_pack;
+
+  // The last term of a name that template arguments were added to.
+  DemangledTypePtr last_templated;
+
+  // True while reading the name of an encoding (but not any types within it).  Template
+  // arguments read there become the ones that template parameters refer to.
+  bool in_name = false;
+
+  // The outermost symbol under construction, kept so that it can be returned when demangling
+  // fails part way through.
+  DemangledTypePtr partial;
+
+  char peek(size_t ahead = 0) const {
+    return offset + ahead < length ? mangled[offset + ahead] : '\0';
+  }
+  bool consume(char c) {
+    if (peek() != c) {
+      return false;
+    }
+    ++offset;
+    return true;
+  }
+  void expect(char c, char const * desc);
+
+  [[noreturn]] void bad_code(char const * desc);
+  [[noreturn]] void general_error(const std::string & e);
+  void progress(char const * msg);
+
+  DemangledTypePtr get_encoding();
+  DemangledTypePtr get_nested_encoding();
+  void get_clone_suffixes(DemangledType & t);
+  DemangledTypePtr get_special_name();
+  DemangledTypePtr get_thunk();
+  void get_name(DemangledType & t);
+  void get_object_name(DemangledType & t);
+  void get_nested_name(DemangledType & t);
+  void get_local_name(DemangledType & t);
+  DemangledTypePtr get_unqualified_name(DemangledType & t);
+  DemangledTypePtr get_operator_name(DemangledType & t);
+  DemangledTypePtr get_unnamed_type_name();
+
+  DemangledTypePtr get_type();
+  DemangledTypePtr get_type_();
+  DemangledTypePtr get_function_type(bool candidate = true);
+  DemangledTypePtr get_array_type();
+  DemangledTypePtr get_member_pointer_type();
+  DemangledTypePtr get_template_param();
+  bool get_pack_expansion(FunctionArgs & types);
+  DemangledTypePtr get_substitution(bool full = false);
+  void get_args(FunctionArgs & args);
+
+  void add_template_args(FullyQualifiedName & name);
+  void get_template_args(DemangledTemplate & args);
+  void get_template_arg(TemplateArgs & param);
+  static DemangledTypePtr template_arg_type(DemangledTemplateParameter const & arg);
+  DemangledTemplateParameterPtr get_expr_primary();
+  DemangledTemplateParameterPtr get_expression();
+
+  std::string get_source_name();
+  int64_t get_number();
+  size_t get_seq_id();
+  void get_call_offset(int64_t & adjustment, int64_t & vcall_offset);
+  void get_discriminator();
+
+  void add_substitution(DemangledTypePtr const & t) {
+    substitutions.push_back(t);
+    if (debug) {
+      std::cerr << "Substitution " << substitutions.size() - 1 << " is "
+                << TextOutput().convert(*t) << std::endl;
+    }
+  }
+  // Forget the template parameters of substitution candidates that have been removed
+  void forget_substitutions() {
+    auto size = substitutions.size();
+    while (!param_substitutions.empty() && param_substitutions.back().first >= size) {
+      nested_params.erase(param_substitutions.back().first);
+      param_substitutions.pop_back();
+    }
+  }
+  void add_prefix_substitution(FullyQualifiedName const & name) {
+    auto prefix = std::make_shared<DemangledType>();
+    prefix->name = name;
+    add_substitution(prefix);
+  }
+
+ public:
+
+  ItaniumDemangler(char const * mangled, size_t length, bool debug = false);
+
+  DemangledTypePtr analyze();
+
+  // After a failure, the offset of the error and whatever was demangled before it.
+  size_t get_offset() const { return offset; }
+  DemangledTypePtr const & get_partial() const { return partial; }
+};
+
+namespace {
+
+// The names a type contributes when it is used as a prefix of a qualified name (or as the
+// class of a member pointer).
+FullyQualifiedName names_of(DemangledTypePtr const & t)
+{
+  if (!t->name.empty() && !t->is_pointer && !t->is_reference && !t->is_refref) {
+    return t->name;
+  }
+  return FullyQualifiedName{t};
+}
+
+// Whether a nested name had the cv-qualifiers or ref-qualifier of a method.
+bool method_qualified(DemangledType const & t)
+{
+  return t.is_const || t.is_volatile || t.restrict || t.is_reference || t.is_refref;
+}
+
+DemangledTypePtr std_type(char const * name)
+{
+  auto t = std::make_shared<DemangledType>();
+  t->add_name(name);
+  t->add_name("std");
+  return t;
+}
+
+// The unabbreviated forms of std::string and the standard streams, as needed when naming
+// their constructors and destructors.
+DemangledTypePtr std_char_type(char const * name, bool allocator)
+{
+  auto param = [](DemangledTypePtr p) {
+    return std::make_shared<DemangledTemplateParameter>(std::move(p));
+  };
+  auto traits = std_type("char_traits");
+  traits->name.front()->template_parameters.push_back(
+    param(std::make_shared<DemangledType>(Code::CHAR)));
+  auto t = std_type(name);
+  auto & params = t->name.front()->template_parameters;
+  params.push_back(param(std::make_shared<DemangledType>(Code::CHAR)));
+  params.push_back(param(std::move(traits)));
+  if (allocator) {
+    auto alloc = std_type("allocator");
+    alloc->name.front()->template_parameters.push_back(
+      param(std::make_shared<DemangledType>(Code::CHAR)));
+    params.push_back(param(std::move(alloc)));
+  }
+  return t;
+}
+
+bool is_digit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+struct OperatorName {
+  char const code[3];
+  Code value;
+};
+
+// Operators that map directly onto a Code.  Unary and binary forms of the same operator share
+// a name.
+OperatorName const operator_names[] = {
+  {"nw", Code::OP_NEW},           {"na", Code::OP_NEW_ARRAY},
+  {"dl", Code::OP_DELETE},        {"da", Code::OP_DELETE_ARRAY},
+  {"ps", Code::OP_PLUS},          {"ng", Code::OP_MINUS},
+  {"ad", Code::OP_AMP},           {"de", Code::OP_STAR},
+  {"co", Code::OP_BNOT},          {"pl", Code::OP_PLUS},
+  {"mi", Code::OP_MINUS},         {"ml", Code::OP_STAR},
+  {"dv", Code::OP_DIV},           {"rm", Code::OP_MOD},
+  {"an", Code::OP_AMP},           {"or", Code::OP_BOR},
+  {"eo", Code::OP_BXOR},          {"aS", Code::OP_ASSIGN},
+  {"pL", Code::OP_PLUS_ASSIGN},   {"mI", Code::OP_MINUS_ASSIGN},
+  {"mL", Code::OP_STAR_ASSIGN},   {"dV", Code::OP_DIV_ASSIGN},
+  {"rM", Code::OP_MOD_ASSIGN},    {"aN", Code::OP_AMP_ASSIGN},
+  {"oR", Code::OP_BOR_ASSIGN},    {"eO", Code::OP_BXOR_ASSIGN},
+  {"ls", Code::OP_LSHIFT},        {"rs", Code::OP_RSHIFT},
+  {"lS", Code::OP_LSHIFT_ASSIGN}, {"rS", Code::OP_RSHIFT_ASSIGN},
+  {"eq", Code::OP_EQUAL},         {"ne", Code::OP_NOTEQUAL},
+  {"lt", Code::OP_LESS},          {"gt", Code::OP_GREATER},
+  {"le", Code::OP_LESSEQ},        {"ge", Code::OP_GREATEREQ},
+  {"ss", Code::OP_SPACESHIP},     {"nt", Code::OP_NOT},
+  {"aa", Code::OP_AND},           {"oo", Code::OP_OR},
+  {"pp", Code::OP_PLUSPLUS},      {"mm", Code::OP_MINUSMINUS},
+  {"cm", Code::OP_COMMA},         {"pm", Code::OP_INDIRECT_METHOD},
+  {"pt", Code::OP_INDIRECT},      {"cl", Code::OP_CALL},
+  {"ix", Code::OP_INDEX},         {"aw", Code::OP_CO_AWAIT},
+};
+
+} // unnamed namespace
+
+ItaniumDemangler::ItaniumDemangler(char const * m, size_t l, bool d)
+  : mangled(m), length(l), debug(d), offset(0)
+{}
+
+void ItaniumDemangler::expect(char c, char const * desc)
+{
+  if (!consume(c)) {
+    bad_code(desc);
+  }
+}
+
+[[noreturn]] void ItaniumDemangler::bad_code(char const * desc)
+{
+  if (offset >= length) {
+    general_error("Attempt to read past end of mangled string.");
+  }
+  error = boost::str(boost::format("Unrecognized %s code '%c' at offset %d")
+                     % desc % mangled[offset] % offset);
+  throw Error(error);
+}
+
+[[noreturn]] void ItaniumDemangler::general_error(const std::string & e)
+{
+  error = e;
+  throw Error(error);
+}
+
+void ItaniumDemangler::progress(char const * msg)
+{
+  if (debug) {
+    std::cerr << "Parsing " << msg << " at character '" << peek()
+              << "' at offset " << offset << std::endl;
+  }
+}
+
+// Not part of the constructor because it throws.
+DemangledTypePtr ItaniumDemangler::analyze()
+{
+  // Import address table entries
+  static char const import_prefix[] = "__imp_";
+  static size_t const import_length = sizeof(import_prefix) - 1;
+  if (length - offset > import_length
+      && std::memcmp(mangled + offset, import_prefix, import_length) == 0)
+  {
+    progress("import prefix");
+    offset += import_length;
+    auto t = analyze();
+    t->is_imported = true;
+    return t;
+  }
+
+  // 32-bit Windows (MinGW) and Mac OS prefix C++ names with an extra underscore like any
+  // other.
+  if (peek() == '_' && peek(1) == '_' && peek(2) == 'Z') {
+    ++offset;
+  }
+  if (peek() != '_' || peek(1) != 'Z') {
+    general_error("Expected \"_Z\" at start of Itanium mangled name.");
+  }
+  offset += 2;
+
+  auto t = get_encoding();
+  get_clone_suffixes(*t);
+
+  if (offset < length) {
+    error = boost::str(boost::format("Unexpected character '%c' after symbol at offset %d")
+                       % mangled[offset] % offset);
+    throw Error(error);
+  }
+  return t;
+}
+
+// Vendor specific suffixes (such as the ".constprop.0" or ".cold" of compiler generated
+// clones) name variants of the same symbol.  As in libiberty, each is a '.' and a run of
+// lower case letters, digits and underscores, followed by any number of ".<number>"s.  Unlike
+// libiberty, objects can have them too.
+void ItaniumDemangler::get_clone_suffixes(DemangledType & t)
+{
+  auto is_clone_char = [](char c) {
+    return (c >= 'a' && c <= 'z') || is_digit(c) || c == '_';
+  };
+  while (peek() == '.' && is_clone_char(peek(1))) {
+    progress("clone suffix");
+    size_t start = offset;
+    offset += 2;
+    while (is_clone_char(peek())) {
+      ++offset;
+    }
+    while (peek() == '.' && is_digit(peek(1))) {
+      offset += 2;
+      while (is_digit(peek())) {
+        ++offset;
+      }
+    }
+    t.clones.emplace_back(mangled + start, offset - start);
+  }
+}
+
+DemangledTypePtr ItaniumDemangler::get_encoding()
+{
+  char c = peek();
+  if (c == 'T' || c == 'G') {
+    return get_special_name();
+  }
+
+  progress("encoding");
+  auto t = std::make_shared<DemangledType>();
+  if (!partial) partial = t;
+  {
+    bool saved = in_name;
+    in_name = true;
+    get_name(*t);
+    in_name = saved;
+  }
+
+  bool qualified = method_qualified(*t);
+  c = peek();
+  if (c == '\0' || c == '.' || c == 'E') {
+    if (qualified) {
+      general_error("Method qualifiers on a name without a function type.");
+    }
+    // Objects have no type in their mangled name.
+    t->symbol_type = SymbolType::GlobalObject;
+    t->instance_name = std::move(t->name);
+    t->name.clear();
+    return t;
+  }
+
+  progress("function");
+  auto & last = *t->name.front();
+  bool templated = (&last == last_templated.get());
+  bool cdtor = last.is_ctor || last.is_dtor;
+  bool conversion = last.simple_code == Code::OP_TYPE;
+  t->is_func = true;
+  // There's no way to tell class methods from functions in namespaces, except for those that
+  // must be methods.
+  if (cdtor || qualified) {
+    t->symbol_type = SymbolType::ClassMethod;
+    t->is_member = true;
+  } else {
+    t->symbol_type = SymbolType::GlobalFunction;
+  }
+
+  // Only templated functions have their return type encoded, and even then, not constructors,
+  // destructors or conversion operators.  Conversion operators already have their return type
+  // from their name.  For the rest, an empty type stands in for the unknown return type.
+  if (templated && !cdtor && !conversion) {
+    progress("return type");
+    t->retval = get_type();
+  } else if (!t->retval) {
+    t->retval = std::make_shared<DemangledType>();
+  }
+
+  get_args(t->args);
+  return t;
+}
+
+// Function arguments, which end at the end of the symbol or an 'E'.  A lone void argument
+// means that there are no arguments.
+void ItaniumDemangler::get_args(FunctionArgs & args)
+{
+  progress("start of function arguments");
+  // An expansion of an empty parameter pack still counts as an argument.
+  bool found = false;
+  while (true) {
+    char c = peek();
+    if (c == '\0' || c == '.' || c == 'E') {
+      break;
+    }
+    // Ref-qualifiers at the end of function types
+    if ((c == 'R' || c == 'O') && peek(1) == 'E') {
+      break;
+    }
+    progress("function argument");
+    if (!get_pack_expansion(args)) {
+      args.push_back(get_type());
+    }
+    found = true;
+  }
+  if (!found) {
+    bad_code("function argument");
+  }
+  if (args.size() == 1 && args.front()->simple_code == Code::VOID) {
+    args.clear();
+  }
+}
+
+DemangledTypePtr ItaniumDemangler::get_special_name()
+{
+  progress("special name");
+  char c = peek();
+  char kind = peek(1);
+  offset += 2;
+  if (c == 'T' && (kind == 'h' || kind == 'v' || kind == 'c')) {
+    offset -= 2;
+    return get_thunk();
+  }
+  if (c == 'G' && kind == 'T' && (peek() == 't' || peek() == 'n')) {
+    // Transactional memory clones of a function
+    bool transaction = mangled[offset++] == 't';
+    auto t = get_encoding();
+    t->transaction_clone = transaction;
+    t->non_transaction_clone = !transaction;
+    return t;
+  }
+
+  auto t = std::make_shared<DemangledType>();
+  if (!partial) partial = t;
+  if (c == 'T') {
+    switch (kind) {
+     case 'V': // vtable
+     case 'T': // VTT
+      {
+        t->symbol_type = SymbolType::VTable;
+        t->instance_name = names_of(get_type());
+        t->instance_name.insert(t->instance_name.begin(), std::make_shared<DemangledType>(
+                                  kind == 'V' ? Code::VFTABLE : Code::VTT));
+      }
+      return t;
+     case 'C': // construction vtable
+      {
+        t->symbol_type = SymbolType::VTable;
+        t->instance_name = names_of(get_type());
+        t->instance_name.insert(t->instance_name.begin(),
+                                std::make_shared<DemangledType>(Code::CONSTRUCTION_VTABLE));
+        get_number();
+        expect('_', "construction vtable");
+        auto base = std::make_shared<DemangledType>();
+        base->name = names_of(get_type());
+        t->com_interface.push_back(std::move(base));
+      }
+      return t;
+     case 'I': // typeinfo
+     case 'S': // typeinfo name
+      t->symbol_type = SymbolType::RTTI;
+      t->retval = get_type();
+      t->add_name(kind == 'I' ? Code::RTTI_TYPE_DESC : Code::TYPEINFO_NAME);
+      return t;
+     case 'W': // TLS wrapper function
+     case 'H': // TLS init function
+      t->symbol_type = SymbolType::GlobalObject;
+      get_object_name(*t);
+      t->instance_name = std::move(t->name);
+      t->name.clear();
+      t->instance_name.insert(t->instance_name.begin(), std::make_shared<DemangledType>(
+                                kind == 'W' ? Code::TLS_WRAPPER : Code::TLS_INIT));
+      return t;
+    }
+  } else {
+    switch (kind) {
+     case 'V': // guard variable
+      t->symbol_type = SymbolType::StaticGuard;
+      get_object_name(*t);
+      t->name.insert(t->name.begin(),
+                     std::make_shared<DemangledType>(Code::LOCAL_STATIC_GUARD));
+      return t;
+     case 'R': // reference temporary
+      t->symbol_type = SymbolType::GlobalObject;
+      get_object_name(*t);
+      if (peek() != '_') {
+        get_seq_id();
+      }
+      expect('_', "reference temporary");
+      t->instance_name = std::move(t->name);
+      t->name.clear();
+      t->instance_name.insert(t->instance_name.begin(),
+                              std::make_shared<DemangledType>(Code::REFERENCE_TEMPORARY));
+      return t;
+    }
+  }
+  offset -= 1;
+  bad_code("special name");
+}
+
+// Thunks adjust the this pointer before calling the encoded method.  Non-virtual thunks are
+// the equivalent of Visual Studio's adjustor thunks, and virtual thunks of its vtordisp
+// thunks.  Covariant return thunks are treated as the non-virtual thunk of their this
+// adjustment, since there's no way to represent the return value adjustment.
+DemangledTypePtr ItaniumDemangler::get_thunk()
+{
+  progress("thunk");
+  ++offset;
+  char kind = peek();
+  int64_t adjustment = 0;
+  int64_t vcall_offset = 0;
+  if (kind == 'c') {
+    ++offset;
+    get_call_offset(adjustment, vcall_offset);
+    int64_t ignored_adjustment, ignored_vcall_offset;
+    get_call_offset(ignored_adjustment, ignored_vcall_offset);
+  } else {
+    get_call_offset(adjustment, vcall_offset);
+  }
+
+  auto t = get_encoding();
+  if (!t->is_func) {
+    general_error("Thunks must be to functions.");
+  }
+  t->symbol_type = (kind == 'v') ? SymbolType::VtorDisp : SymbolType::ClassMethod;
+  t->is_member = true;
+  t->method_property = MethodProperty::Thunk;
+  if (kind == 'v') {
+    t->n = {vcall_offset, -adjustment};
+  } else {
+    t->n = {0, -adjustment};
+  }
+  return t;
+}
+
+void ItaniumDemangler::get_call_offset(int64_t & adjustment, int64_t & vcall_offset)
+{
+  progress("call offset");
+  vcall_offset = 0;
+  switch (peek()) {
+   case 'h':
+    ++offset;
+    adjustment = get_number();
+    break;
+   case 'v':
+    ++offset;
+    adjustment = get_number();
+    expect('_', "call offset");
+    vcall_offset = get_number();
+    break;
+   default:
+    bad_code("call offset");
+  }
+  expect('_', "call offset");
+}
+
+void ItaniumDemangler::get_name(DemangledType & t)
+{
+  switch (peek()) {
+   case 'N':
+    get_nested_name(t);
+    return;
+   case 'Z':
+    get_local_name(t);
+    return;
+  }
+
+  progress("unscoped name");
+  bool substituted = false;
+  if (peek() == 'S' && peek(1) == 't') {
+    offset += 2;
+    t.name.insert(t.name.begin(), std::make_shared<DemangledType>("std"));
+    t.name.insert(t.name.begin(), get_unqualified_name(t));
+  } else if (peek() == 'S') {
+    // Only a template name can be substituted here, since the template arguments must follow.
+    t.name = names_of(get_substitution());
+    if (peek() != 'I') {
+      bad_code("template arguments");
+    }
+    substituted = true;
+  } else {
+    t.name.insert(t.name.begin(), get_unqualified_name(t));
+  }
+
+  if (peek() == 'I') {
+    if (!substituted) {
+      add_prefix_substitution(t.name);
+    }
+    add_template_args(t.name);
+  }
+}
+
+// The name of an object, which can't have method qualifiers.
+void ItaniumDemangler::get_object_name(DemangledType & t)
+{
+  get_name(t);
+  if (method_qualified(t)) {
+    general_error("Method qualifiers on a name without a function type.");
+  }
+}
+
+void ItaniumDemangler::get_nested_name(DemangledType & t)
+{
+  expect('N', "nested name");
+  progress("nested name");
+
+  // The cv-qualifiers and ref-qualifiers of methods.
+  while (true) {
+    if (consume('r')) t.restrict = true;
+    else if (consume('V')) t.is_volatile = true;
+    else if (consume('K')) t.is_const = true;
+    else break;
+  }
+  if (consume('R')) t.is_reference = true;
+  else if (consume('O')) t.is_refref = true;
+
+  auto & name = t.name;
+  while (!consume('E')) {
+    char c = peek();
+    bool candidate = true;
+    if (c == 'S' && peek(1) == 't') {
+      offset += 2;
+      name.insert(name.begin(), std::make_shared<DemangledType>("std"));
+      continue;
+    } else if (c == 'S') {
+      // Constructors and destructors of std::string and the standard streams are named after
+      // the full basic_string or basic_*stream template.
+      char next = peek(2);
+      bool full = (next == 'C' || (next == 'D' && is_digit(peek(3))));
+      name = names_of(get_substitution(full));
+      candidate = false;
+    } else if (c == 'T') {
+      name = names_of(get_template_param());
+    } else if (c == 'I') {
+      if (name.empty()) {
+        bad_code("nested name");
+      }
+      add_template_args(name);
+    } else if (c == 'M') {
+      // The data member whose initializer contains a closure type.  It's already in the name.
+      ++offset;
+      continue;
+    } else if (c == 'D' && (peek(1) == 't' || peek(1) == 'T')) {
+      general_error("decltype() in names is not supported.");
+    } else if (c == '\0') {
+      bad_code("nested name");
+    } else {
+      name.insert(name.begin(), get_unqualified_name(t));
+    }
+    if (candidate && peek() != 'E') {
+      add_prefix_substitution(name);
+    }
+  }
+
+  if (name.empty()) {
+    general_error("Empty nested name.");
+  }
+}
+
+// An encoding within the symbol, whose template arguments are its own.  Like c++filt, a
+// template parameter that it added as a substitution candidate refers to the outer template
+// arguments after it.
+DemangledTypePtr ItaniumDemangler::get_nested_encoding()
+{
+  auto saved = template_args;
+  auto first = param_substitutions.size();
+  auto t = get_encoding();
+  template_args = std::move(saved);
+  nested_params.insert(param_substitutions.begin() + first, param_substitutions.end());
+  return t;
+}
+
+// Names local to a function, which are qualified by the (embedded) function symbol.
+void ItaniumDemangler::get_local_name(DemangledType & t)
+{
+  expect('Z', "local name");
+  progress("local name");
+  auto function = get_nested_encoding();
+  function->is_embedded = true;
+  expect('E', "local name");
+
+  if (consume('s')) {
+    // A string literal
+    t.name.insert(t.name.begin(), std::make_shared<DemangledType>(Code::STRING_LITERAL));
+  } else {
+    if (consume('d')) {
+      // Within a default argument of the function
+      if (peek() != '_') {
+        get_number();
+      }
+      expect('_', "default argument");
+    }
+    get_name(t);
+  }
+  get_discriminator();
+  t.name.push_back(std::move(function));
+}
+
+void ItaniumDemangler::get_discriminator()
+{
+  if (peek() != '_') {
+    return;
+  }
+  progress("discriminator");
+  ++offset;
+  if (is_digit(peek())) {
+    ++offset;
+  } else {
+    expect('_', "discriminator");
+    get_number();
+    expect('_', "discriminator");
+  }
+}
+
+DemangledTypePtr ItaniumDemangler::get_unqualified_name(DemangledType & t)
+{
+  progress("unqualified name");
+  DemangledTypePtr term;
+  char c = peek();
+  if (is_digit(c)) {
+    auto name = get_source_name();
+    term = std::make_shared<DemangledType>(std::move(name));
+    if (term->simple_string.compare(0, 10, "_GLOBAL__N") == 0) {
+      // The rest of the name is an implementation detail, not a unique identifier
+      term->is_anonymous = true;
+      term->simple_string.clear();
+    }
+  } else if (c == 'C') {
+    ++offset;
+    if (consume('I')) {
+      // Inheriting constructor, followed by the base class
+      if (!is_digit(peek())) bad_code("constructor");
+      ++offset;
+      get_type();
+    } else {
+      if (!is_digit(peek())) bad_code("constructor");
+      ++offset;
+    }
+    term = std::make_shared<DemangledType>();
+    term->is_ctor = true;
+  } else if (c == 'D' && is_digit(peek(1))) {
+    offset += 2;
+    term = std::make_shared<DemangledType>();
+    term->is_dtor = true;
+  } else if (c == 'U') {
+    term = get_unnamed_type_name();
+  } else if (c == 'L') {
+    // Names with internal linkage
+    ++offset;
+    term = std::make_shared<DemangledType>(get_source_name());
+    get_discriminator();
+  } else if (c >= 'a' && c <= 'z') {
+    term = get_operator_name(t);
+  } else {
+    bad_code("name");
+  }
+
+  // ABI tags
+  while (consume('B')) {
+    term->abi_tags.push_back(get_source_name());
+  }
+  return term;
+}
+
+DemangledTypePtr ItaniumDemangler::get_operator_name(DemangledType & t)
+{
+  progress("operator name");
+  char a = peek();
+  char b = peek(1);
+  offset += 2;
+  for (auto & op : operator_names) {
+    if (op.code[0] == a && op.code[1] == b) {
+      return std::make_shared<DemangledType>(op.value);
+    }
+  }
+  if (a == 'c' && b == 'v') {
+    // Conversion operators are rendered using the symbol's return value.
+    t.retval = get_type();
+    return std::make_shared<DemangledType>(Code::OP_TYPE);
+  }
+  if (a == 'l' && b == 'i') {
+    return std::make_shared<DemangledType>("operator\"\" " + get_source_name());
+  }
+  if (a == 'v' && is_digit(b)) {
+    return std::make_shared<DemangledType>("operator " + get_source_name());
+  }
+  offset -= 2;
+  bad_code("operator name");
+}
+
+DemangledTypePtr ItaniumDemangler::get_unnamed_type_name()
+{
+  progress("unnamed type");
+  ++offset;
+  std::string name;
+  if (consume('t')) {
+    name = "{unnamed type#";
+  } else if (consume('l')) {
+    // Closure types are named after the lambda's arguments
+    FunctionArgs args;
+    get_args(args);
+    expect('E', "lambda");
+    name = "{lambda(";
+    TextOutput text;
+    for (auto & arg : args) {
+      if (&arg != &args.front()) {
+        name += ", ";
+      }
+      text.append(name, *arg);
+    }
+    name += ")#";
+  } else {
+    --offset;
+    bad_code("unnamed type");
+  }
+  int64_t number = 1;
+  if (peek() != '_') {
+    number = get_number() + 2;
+  }
+  expect('_', "unnamed type");
+  name += std::to_string(number) + '}';
+  return std::make_shared<DemangledType>(std::move(name));
+}
+
+DemangledTypePtr ItaniumDemangler::get_type()
+{
+  // Template arguments within types are never the ones referred to by template parameters.
+  bool saved = in_name;
+  in_name = false;
+  auto t = get_type_();
+  in_name = saved;
+  return t;
+}
+
+DemangledTypePtr ItaniumDemangler::get_type_()
+{
+  progress("type");
+  // Builtin types, which are one character long, or two when starting with 'D'.
+  auto simple = [this](Code code) {
+    offset += (peek() == 'D') ? 2 : 1;
+    return std::make_shared<DemangledType>(code);
+  };
+
+  char c = peek();
+  switch (c) {
+   case 'v': return simple(Code::VOID);
+   case 'w': return simple(Code::WCHAR);
+   case 'b': return simple(Code::BOOL);
+   case 'c': return simple(Code::CHAR);
+   case 'a': return simple(Code::SIGNED_CHAR);
+   case 'h': return simple(Code::UNSIGNED_CHAR);
+   case 's': return simple(Code::SHORT);
+   case 't': return simple(Code::UNSIGNED_SHORT);
+   case 'i': return simple(Code::INT);
+   case 'j': return simple(Code::UNSIGNED_INT);
+   case 'l': return simple(Code::LONG);
+   case 'm': return simple(Code::UNSIGNED_LONG);
+   case 'x': return simple(Code::LONG_LONG);
+   case 'y': return simple(Code::UNSIGNED_LONG_LONG);
+   case 'n': return simple(Code::INT128);
+   case 'o': return simple(Code::UINT128);
+   case 'f': return simple(Code::FLOAT);
+   case 'd': return simple(Code::DOUBLE);
+   case 'e': return simple(Code::LONG_DOUBLE);
+   case 'g': return simple(Code::FLOAT128);
+   case 'z': return simple(Code::ELLIPSIS);
+   case 'u': // vendor extended type
+    {
+      ++offset;
+      auto t = std::make_shared<DemangledType>(get_source_name());
+      add_substitution(t);
+      return t;
+    }
+   case 'r': case 'V': case 'K':
+    {
+      bool is_restrict = false, is_volatile = false, is_const = false;
+      while (true) {
+        if (consume('r')) is_restrict = true;
+        else if (consume('V')) is_volatile = true;
+        else if (consume('K')) is_const = true;
+        else break;
+      }
+      // The unqualified type may be shared, so qualify a copy of it.  The qualifiers of a
+      // member function type apply to this, so like c++filt the unqualified function type
+      // isn't a substitution candidate.
+      auto t = (peek() == 'F') ? get_function_type(false)
+               : std::make_shared<DemangledType>(*get_type());
+      t->restrict |= is_restrict;
+      t->is_volatile |= is_volatile;
+      t->is_const |= is_const;
+      add_substitution(t);
+      return t;
+    }
+   case 'P': case 'R': case 'O':
+    {
+      ++offset;
+      auto inner = get_type();
+      DemangledTypePtr t;
+      if (c != 'P' && (inner->is_reference || inner->is_refref)) {
+        // References to references collapse, which can occur in pack expansions.
+        t = std::make_shared<DemangledType>(*inner);
+        t->is_refref = (c == 'O' && inner->is_refref);
+        t->is_reference = !t->is_refref;
+      } else {
+        t = std::make_shared<DemangledType>();
+        t->is_pointer = (c == 'P');
+        t->is_reference = (c == 'R');
+        t->is_refref = (c == 'O');
+        t->inner_type = std::move(inner);
+      }
+      add_substitution(t);
+      return t;
+    }
+   case 'F': return get_function_type();
+   case 'A': return get_array_type();
+   case 'M': return get_member_pointer_type();
+   case 'T':
+    {
+      param_substitutions.emplace_back(substitutions.size(), offset);
+      auto t = get_template_param();
+      add_substitution(t);
+      if (peek() == 'I') {
+        // A template template parameter
+        auto param = std::move(t);
+        t = std::make_shared<DemangledType>();
+        t->name = names_of(param);
+        add_template_args(t->name);
+        add_substitution(t);
+      }
+      return t;
+    }
+   case 'S':
+    {
+      DemangledTypePtr t;
+      if (peek(1) == 't') {
+        offset += 2;
+        t = std::make_shared<DemangledType>();
+        t->name.push_back(get_unqualified_name(*t));
+        t->add_name("std");
+        if (peek() != 'I') {
+          add_substitution(t);
+          return t;
+        }
+        add_prefix_substitution(t->name);
+      } else {
+        auto sub = get_substitution();
+        if (peek() != 'I') {
+          return sub;
+        }
+        t = std::make_shared<DemangledType>();
+        t->name = names_of(sub);
+      }
+      add_template_args(t->name);
+      add_substitution(t);
+      return t;
+    }
+   case 'D':
+    switch (peek(1)) {
+     case 'a': return simple(Code::AUTO);
+     case 'c': return simple(Code::DECLTYPE_AUTO);
+     case 'd': return simple(Code::DECIMAL64);
+     case 'e': return simple(Code::DECIMAL128);
+     case 'f': return simple(Code::DECIMAL32);
+     case 'h': return simple(Code::HALF);
+     case 'i': return simple(Code::CHAR32);
+     case 's': return simple(Code::CHAR16);
+     case 'u': return simple(Code::CHAR8);
+     case 'n':
+      offset += 2;
+      return std_type("nullptr_t");
+     case 'F':
+      {
+        offset += 2;
+        size_t start = offset;
+        while (is_digit(peek())) {
+          ++offset;
+        }
+        std::string bits(mangled + start, offset - start);
+        expect('_', "_FloatN type");
+        return std::make_shared<DemangledType>("_Float" + bits);
+      }
+     case 'p':
+      // Pack expansions are represented by the pattern alone.
+      offset += 2;
+      return get_type();
+     case 'v':
+      {
+        // Vector types
+        offset += 2;
+        auto size = get_number();
+        expect('_', "vector type");
+        auto element = get_type();
+        auto t = std::make_shared<DemangledType>(
+          TextOutput().convert(*element) + " __vector(" + std::to_string(size) + ")");
+        add_substitution(t);
+        return t;
+      }
+     case 't': case 'T':
+      general_error("decltype() types are not supported.");
+    }
+    bad_code("type");
+   case 'U':
+    {
+      // Vendor qualifiers (such as Objective-C's __strong) don't affect the C++ type.
+      ++offset;
+      get_source_name();
+      if (peek() == 'I') {
+        DemangledTemplate ignored;
+        get_template_args(ignored);
+      }
+      return get_type();
+    }
+   case 'N': case 'Z':
+   case '0': case '1': case '2': case '3': case '4':
+   case '5': case '6': case '7': case '8': case '9':
+    {
+      // A class or enum type
+      auto t = std::make_shared<DemangledType>();
+      get_name(*t);
+      if (t->is_reference || t->is_refref) {
+        // A ref-qualifier belongs to a method, but there's none here.  Refer to the class,
+        // as c++filt does.
+        auto ref = std::make_shared<DemangledType>();
+        std::swap(ref->is_reference, t->is_reference);
+        std::swap(ref->is_refref, t->is_refref);
+        ref->inner_type = std::move(t);
+        t = std::move(ref);
+      }
+      add_substitution(t);
+      return t;
+    }
+  }
+  bad_code("type");
+}
+
+DemangledTypePtr ItaniumDemangler::get_function_type(bool candidate)
+{
+  progress("function type");
+  expect('F', "function type");
+  // extern "C" function types are otherwise identical.
+  consume('Y');
+  auto t = std::make_shared<DemangledType>();
+  t->is_func = true;
+  t->retval = get_type();
+  get_args(t->args);
+  if (consume('R')) t->is_reference = true;
+  else if (consume('O')) t->is_refref = true;
+  expect('E', "function type");
+  if (candidate) {
+    add_substitution(t);
+  }
+  return t;
+}
+
+// Arrays are represented by their element type, with the dimensions added.
+DemangledTypePtr ItaniumDemangler::get_array_type()
+{
+  progress("array type");
+  expect('A', "array type");
+  uint64_t dimension = DemangledType::unbounded_dimension;
+  if (is_digit(peek())) {
+    dimension = uint64_t(get_number());
+  } else if (peek() != '_') {
+    general_error("Array dimension expressions are not supported.");
+  }
+  expect('_', "array type");
+  auto t = std::make_shared<DemangledType>(*get_type());
+  t->is_array = true;
+  t->dimensions.insert(t->dimensions.begin(), dimension);
+  add_substitution(t);
+  return t;
+}
+
+DemangledTypePtr ItaniumDemangler::get_member_pointer_type()
+{
+  progress("member pointer type");
+  expect('M', "member pointer type");
+  auto t = std::make_shared<DemangledType>();
+  t->is_pointer = true;
+  t->name = names_of(get_type());
+  t->inner_type = std::make_shared<DemangledType>(*get_type());
+  t->inner_type->is_member = true;
+  add_substitution(t);
+  return t;
+}
+
+DemangledTypePtr ItaniumDemangler::get_template_param()
+{
+  progress("template parameter");
+  expect('T', "template parameter");
+  size_t index = 0;
+  if (!consume('_')) {
+    index = size_t(get_number()) + 1;
+    expect('_', "template parameter");
+  }
+  if (index < template_args.size()) {
+    auto & param = template_args[index];
+    if (!param.pack) {
+      return template_arg_type(*param.args.front());
+    }
+    if (pack_size == no_pack) {
+      pack_size = param.args.size();
+    }
+    if (pack_index < param.args.size()) {
+      return template_arg_type(*param.args[pack_index]);
+    }
+  }
+  // Forward references (from the type of a templated conversion operator) can't be resolved
+  // until after they are used, and packs can't be used outside of a pack expansion.  Kludge
+  // something up instead.
+  return std::make_shared<DemangledType>(
+    boost::str(boost::format("`template-parameter-%d'") % (index + 1)));
+}
+
+DemangledTypePtr ItaniumDemangler::template_arg_type(DemangledTemplateParameter const & arg)
+{
+  if (arg.type) {
+    return arg.type;
+  }
+  return std::make_shared<DemangledType>(std::to_string(arg.constant_value));
+}
+
+// Pack expansions are replaced by the pattern once for each argument in the parameter pack
+// that it refers to, by reading the pattern again for each one.  Returns false if there's no
+// pack expansion to read.
+bool ItaniumDemangler::get_pack_expansion(FunctionArgs & types)
+{
+  if (peek() != 'D' || peek(1) != 'p') {
+    return false;
+  }
+  progress("pack expansion");
+  offset += 2;
+
+  auto saved_size = pack_size;
+  auto saved_index = pack_index;
+  pack_size = no_pack;
+  pack_index = no_pack;
+  size_t start = offset;
+  auto pattern = get_type();
+
+  if (pack_size == no_pack) {
+    // Not a parameter pack (or an unresolvable one), so just use the pattern.
+    types.push_back(pattern);
+  } else {
+    // The substitution candidates are those of the pattern, not of its expansions.
+    auto end = offset;
+    auto pattern_substitutions = substitutions;
+    for (pack_index = 0; pack_index < pack_size; ++pack_index) {
+      offset = start;
+      types.push_back(get_type());
+    }
+    offset = end;
+    substitutions = std::move(pattern_substitutions);
+    forget_substitutions();
+  }
+  add_substitution(pattern);
+
+  pack_size = saved_size;
+  pack_index = saved_index;
+  return true;
+}
+
+DemangledTypePtr ItaniumDemangler::get_substitution(bool full)
+{
+  progress("substitution");
+  expect('S', "substitution");
+  switch (peek()) {
+   case 'a': ++offset; return std_type("allocator");
+   case 'b': ++offset; return std_type("basic_string");
+   case 's': ++offset; return full ? std_char_type("basic_string", true) : std_type("string");
+   case 'i': ++offset; return full ? std_char_type("basic_istream", false) : std_type("istream");
+   case 'o': ++offset; return full ? std_char_type("basic_ostream", false) : std_type("ostream");
+   case 'd':
+    ++offset;
+    return full ? std_char_type("basic_iostream", false) : std_type("iostream");
+  }
+
+  size_t index = 0;
+  if (!consume('_')) {
+    index = get_seq_id() + 1;
+    expect('_', "substitution");
+  }
+  if (index >= substitutions.size()) {
+    general_error(boost::str(boost::format("Invalid substitution S%d_ at offset %d")
+                             % index % offset));
+  }
+  auto nested = nested_params.find(index);
+  if (nested != nested_params.end()) {
+    // A template parameter from a nested encoding, read again for the current arguments
+    auto end = offset;
+    offset = nested->second;
+    auto t = get_template_param();
+    offset = end;
+    return t;
+  }
+  if (debug) {
+    std::cerr << "Substitution refers to " << TextOutput().convert(*substitutions[index])
+              << std::endl;
+  }
+  return substitutions[index];
+}
+
+// Apply template arguments to the last term of a name.  The term may be shared with a
+// substitution, so the arguments are applied to a copy.
+void ItaniumDemangler::add_template_args(FullyQualifiedName & name)
+{
+  auto term = std::make_shared<DemangledType>(*name.front());
+  term->template_parameters.clear();
+  get_template_args(term->template_parameters);
+  last_templated = term;
+  name.front() = std::move(term);
+}
+
+void ItaniumDemangler::get_template_args(DemangledTemplate & args)
+{
+  progress("template arguments");
+  expect('I', "template arguments");
+  bool capture = in_name;
+  in_name = false;
+  std::vector<TemplateArgs> params;
+  while (!consume('E')) {
+    params.emplace_back();
+    get_template_arg(params.back());
+  }
+  in_name = capture;
+  for (auto & param : params) {
+    args.insert(args.end(), param.args.begin(), param.args.end());
+  }
+  // A null parameter keeps an empty argument list (from an empty pack) as "<>"
+  if (args.empty()) {
+    args.push_back(nullptr);
+  }
+  if (capture) {
+    template_args = std::move(params);
+  }
+}
+
+void ItaniumDemangler::get_template_arg(TemplateArgs & param)
+{
+  progress("template argument");
+  auto & args = param.args;
+  switch (peek()) {
+   case 'L':
+    args.push_back(get_expr_primary());
+    break;
+   case 'X':
+    ++offset;
+    args.push_back(get_expression());
+    expect('E', "template argument expression");
+    break;
+   case 'J':
+    // Argument packs are flattened into the argument list.
+    ++offset;
+    param.pack = true;
+    while (!consume('E')) {
+      get_template_arg(param);
+      param.pack = true;
+    }
+    break;
+   default:
+    {
+      FunctionArgs types;
+      if (get_pack_expansion(types)) {
+        param.pack = true;
+      } else {
+        types.push_back(get_type());
+      }
+      for (auto & type : types) {
+        args.push_back(std::make_shared<DemangledTemplateParameter>(std::move(type)));
+      }
+    }
+  }
+}
+
+DemangledTemplateParameterPtr ItaniumDemangler::get_expr_primary()
+{
+  progress("literal");
+  expect('L', "literal");
+  if (peek() == '_' && peek(1) == 'Z') {
+    // The address of an external name
+    offset += 2;
+    auto param = std::make_shared<DemangledTemplateParameter>(get_nested_encoding());
+    param->pointer = true;
+    expect('E', "literal");
+    return param;
+  }
+
+  // As in c++filt, integer literals have the suffix of their type where C++ has one, and are
+  // otherwise rendered as a cast like everything else.
+  auto type = get_type();
+  bool integral = !type->is_pointer && !type->is_reference && !type->is_refref;
+  char const * suffix = nullptr;
+  switch (integral ? type->simple_code : Code::UNDEFINED) {
+   case Code::INT:
+    {
+      int64_t value = get_number();
+      expect('E', "literal");
+      return std::make_shared<DemangledTemplateParameter>(value);
+    }
+   case Code::UNSIGNED_INT: suffix = "u"; break;
+   case Code::LONG: suffix = "l"; break;
+   case Code::UNSIGNED_LONG: suffix = "ul"; break;
+   case Code::LONG_LONG: suffix = "ll"; break;
+   case Code::UNSIGNED_LONG_LONG: suffix = "ull"; break;
+   case Code::BOOL:
+    if ((peek() == '0' || peek() == '1') && peek(1) == 'E') {
+      bool value = peek() == '1';
+      offset += 2;
+      return std::make_shared<DemangledTemplateParameter>(
+        std::make_shared<DemangledType>(value ? "true" : "false"));
+    }
+    break;
+   case Code::CHAR: case Code::SIGNED_CHAR: case Code::UNSIGNED_CHAR:
+   case Code::SHORT: case Code::UNSIGNED_SHORT:
+   case Code::INT128: case Code::UINT128:
+   case Code::WCHAR: case Code::CHAR8: case Code::CHAR16: case Code::CHAR32:
+    break;
+   default:
+    // Floating point values, null pointers, enumerators, and so on
+    integral = false;
+  }
+
+  size_t start = offset;
+  if (integral) {
+    consume('n');
+    if (!is_digit(peek())) {
+      bad_code("number");
+    }
+    while (is_digit(peek())) {
+      ++offset;
+    }
+  } else {
+    while (peek() != 'E') {
+      if (peek() == '\0') {
+        bad_code("literal");
+      }
+      ++offset;
+    }
+  }
+  std::string value(mangled + start, offset - start);
+  expect('E', "literal");
+  if (!value.empty() && value.front() == 'n') {
+    value.front() = '-';
+  }
+  if (suffix) {
+    return std::make_shared<DemangledTemplateParameter>(
+      std::make_shared<DemangledType>(value + suffix));
+  }
+  return std::make_shared<DemangledTemplateParameter>(
+    std::make_shared<DemangledType>("(" + TextOutput().convert(*type) + ")" + value));
+}
+
+DemangledTemplateParameterPtr ItaniumDemangler::get_expression()
+{
+  progress("expression");
+  switch (peek()) {
+   case 'L':
+    return get_expr_primary();
+   case 'T':
+    return std::make_shared<DemangledTemplateParameter>(get_template_param());
+   case 'a':
+    if (peek(1) == 'd' && peek(2) == 'L') {
+      offset += 2;
+      auto param = get_expr_primary();
+      if (param->type) {
+        param->pointer = true;
+      }
+      return param;
+    }
+    break;
+  }
+  general_error(boost::str(boost::format("Unsupported template argument expression at offset %d")
+                           % offset));
+}
+
+std::string ItaniumDemangler::get_source_name()
+{
+  progress("source name");
+  if (!is_digit(peek())) {
+    bad_code("source name");
+  }
+  auto size = get_number();
+  if (size <= 0 || size_t(size) > length - offset) {
+    general_error(boost::str(boost::format("Invalid source name length %d at offset %d")
+                             % size % offset));
+  }
+  std::string name(mangled + offset, size_t(size));
+  offset += size_t(size);
+  return name;
+}
+
+// Decimal numbers, where negative numbers are prefixed with 'n'.
+int64_t ItaniumDemangler::get_number()
+{
+  progress("number");
+  bool negative = consume('n');
+  if (!is_digit(peek())) {
+    bad_code("number");
+  }
+  int64_t num = 0;
+  size_t digits_found = 0;
+  while (is_digit(peek())) {
+    if (++digits_found > 18) {
+      general_error("There were too many digits in the number.");
+    }
+    num = num * 10 + (mangled[offset++] - '0');
+  }
+  return negative ? -num : num;
+}
+
+// Base 36 numbers using digits and upper case letters.
+size_t ItaniumDemangler::get_seq_id()
+{
+  size_t num = 0;
+  size_t digits_found = 0;
+  while (true) {
+    char c = peek();
+    if (is_digit(c)) {
+      num = num * 36 + size_t(c - '0');
+    } else if (c >= 'A' && c <= 'Z') {
+      num = num * 36 + size_t(c - 'A') + 10;
+    } else {
+      break;
+    }
+    if (++digits_found > 8) {
+      general_error("There were too many digits in the sequence number.");
+    }
+    ++offset;
+  }
+  if (digits_found == 0) {
+    bad_code("sequence number");
+  }
+  return num;
+}
+
+} // namespace detail
+
+DemangledTypePtr itanium_demangle(const std::string & mangled, bool debug)
+{
+  detail::ItaniumDemangler demangler(mangled.data(), mangled.size(), debug);
+  return demangler.analyze();
+}
+
+DemangleResult itanium_demangle_partial(const std::string & mangled, bool debug)
+{
+  detail::ItaniumDemangler demangler(mangled.data(), mangled.size(), debug);
+  DemangleResult result;
+  try {
+    result.symbol = demangler.analyze();
+  } catch (Error const & e) {
+    result.symbol = demangler.get_partial();
+    if (result.symbol && !result.symbol->is_func) {
+      // The ref-qualifiers of a method whose function type was never reached would otherwise
+      // render as a reference to nothing.
+      result.symbol->is_reference = false;
+      result.symbol->is_refref = false;
+    }
+    result.error = e.what();
+    result.error_offset = demangler.get_offset();
+  }
+  return result;
+}
+
+bool is_itanium_name(const std::string & mangled)
+{
+  static char const import_prefix[] = "__imp_";
+  size_t pos = 0;
+  if (mangled.compare(0, sizeof(import_prefix) - 1, import_prefix) == 0) {
+    pos = sizeof(import_prefix) - 1;
+  }
+  if (mangled.compare(pos, 3, "__Z") == 0) {
+    ++pos;
+  }
+  return mangled.compare(pos, 2, "_Z") == 0;
+}
+
+} // namespace demangle
+
+/* Local Variables:   */
+/* mode: c++          */
+/* fill-column:    95 */
+/* comment-column: 0  */
+/* End:               */
@@ -23,13 +23,18 @@
 #include "json.hpp"
 
 #include <vector>               // std::vector
-#include <map>                  // std::map
 #include <utility>              // std::move
-#include <cctype>               // std::iscntrl
-#include <ios>                  // std::hex
-#include <iomanip>              // std::setw
-#include <iterator>             // std::ostreambuf_iterator
-#include <algorithm>            // std::fill_n
+#include <algorithm>            // std::replace
+#include <cstdio>               // std::snprintf
+#include <clocale>              // std::localeconv
+#include <cstring>              // std::strlen, std::memcmp
+#include <cassert>              // assert
+#include <cstddef>              // std::max_align_t
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define JSON_USE_SSE2
+#include <emmintrin.h>          // SSE2 intrinsics
+#endif
 
 namespace json {
 
@@ -67,16 +72,35 @@ NodeRef Simple::apply(Builder const & builder)
 }
 
 namespace {
+
+// The length of the leading run of ASCII characters in a string
+std::size_t ascii_prefix(char const * s, std::size_t n)
+{
+  std::size_t i = 0;
+#ifdef JSON_USE_SSE2
+  for (; i + 16 <= n; i += 16) {
+    if (_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<__m128i const *>(s + i)))) {
+      break;
+    }
+  }
+#endif
+  while (i < n && !(s[i] & 0x80)) {
+    ++i;
+  }
+  return i;
+}
+
 // Return whether this is a valid utf-8 string.  If it is is, return 0.  If not, return -1.  If
 // it is valid, but truncated, return the number of bytes that need to be truncated to make the
 // string valid.
-int is_valid_utf8(std::string const & s) {
-  std::string::size_type count = 0;
+int is_valid_utf8(char const * s, std::size_t n) {
+  std::size_t count = 0;
   int trailing_chars = 0;
   int tcc = 0;
   int nonzero = 0;
   uint32_t val = 0;
-  for (unsigned char c : s) {
+  for (std::size_t i = ascii_prefix(s, n); i < n; ++i) {
+    unsigned char c = s[i];
     if (c & 0x80) {
       if (trailing_chars) {
         if ((c & 0x40) || (nonzero && !(c & nonzero))) {
@@ -125,16 +149,59 @@ int is_valid_utf8(std::string const & s) {
   return 0;
 }
 
-std::ostream & output_string(std::ostream & stream, std::string const & s)
+// Return the index of the first byte at or after i that has to be escaped.  Those are the
+// control characters, '"', and '\\', as well as any byte with the high bit set when
+// escape_high is true (used when the string is not valid UTF-8).  Returns n if there are none.
+std::size_t find_escape(char const * s, std::size_t i, std::size_t n, bool escape_high)
+{
+#ifdef JSON_USE_SSE2
+  // Find the first 16-byte block with anything to escape, then find it within the block
+  auto const max_control = _mm_set1_epi8(0x1f);
+  auto const quote = _mm_set1_epi8('"');
+  auto const backslash = _mm_set1_epi8('\\');
+  auto const del = _mm_set1_epi8(0x7f);
+  for (; i + 16 <= n; i += 16) {
+    auto v = _mm_loadu_si128(reinterpret_cast<__m128i const *>(s + i));
+    auto control = _mm_cmpeq_epi8(_mm_min_epu8(v, max_control), v);
+    auto special = _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash));
+    auto mask = _mm_movemask_epi8(
+      _mm_or_si128(_mm_or_si128(control, special), _mm_cmpeq_epi8(v, del)));
+    if (escape_high) {
+      mask |= _mm_movemask_epi8(v);
+    }
+    if (mask) {
+      break;
+    }
+  }
+#endif
+  for (; i < n; ++i) {
+    unsigned char c = s[i];
+    if (c < 0x20 || c == '"' || c == '\\' || c == 0x7f || (escape_high && (c & 0x80))) {
+      return i;
+    }
+  }
+  return n;
+}
+
+void output_string(std::string & out, char const * s, std::size_t n)
 {
-  stream << '"';
-  auto ut = is_valid_utf8(s);
-  auto e = s.size();
+  static char const hex[] = "0123456789abcdef";
+  out += '"';
+  auto ut = is_valid_utf8(s, n);
+  auto e = n;
   if (ut >= 0) {
     e -= ut;
   }
-  for (std::string::size_type i = 0; i < e; ++i) {
-    unsigned char c = s[i];
+  std::size_t i = 0;
+  while (i < e) {
+    // Copy everything up to the next character to escape in one go
+    auto next = find_escape(s, i, e, ut < 0);
+    out.append(s + i, next - i);
+    if (next == e) {
+      break;
+    }
+    i = next + 1;
+    unsigned char c = s[next];
     const char *v;
     switch(c) {
      case '"':
@@ -152,138 +219,105 @@ std::ostream & output_string(std::ostream & stream, std::string const & s)
      case '\t':
       v = "\\t";  break;
      default:
-      if (std::iscntrl(c) || ((ut < 0) && c & 0x80)) {
-        auto flags = stream.flags();
-        auto fill = stream.fill('0');
-        stream << "\\u00" << std::setw(2) << std::hex << unsigned(c);
-        stream.flags(flags);
-        stream.fill(fill);
-        continue;
+      {
+        char const u[] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf]};
+        out.append(u, sizeof(u));
       }
-      stream.put(c);
       continue;
     }
-    stream << v;
+    out += v;
   }
-  return stream << '"';
+  out += '"';
 }
 
-class Writer : public Visitor {
- private:
-  std::ostream & stream;
-  unsigned indent;
-  unsigned current_indent;
-  bool empty;
-  bool kv = false;
-
-  void simple_indent() {
-    if (!kv) {
-      do_indent();
-    }
-  }
+void output_uinteger(std::string & out, Simple::uinteger v)
+{
+  char buf[24];
+  auto end = buf + sizeof(buf);
+  auto p = end;
+  do {
+    *--p = char('0' + v % 10);
+    v /= 10;
+  } while (v);
+  out.append(p, std::size_t(end - p));
+}
 
-  template <typename T>
-  bool simple_write(T v) {
-    simple_indent();
-    stream << v;
-    return true;
-  }
-  void inc_indent() {
-    current_indent += indent;
-  }
-  void dec_indent() {
-    current_indent -= indent;
-  }
-  void do_indent() {
-    std::fill_n(
-      std::ostreambuf_iterator<std::ostream::char_type, std::ostream::traits_type>(stream),
-      current_indent, ' ');
-  }
-  void newline() {
-    if (indent) {
-      stream << '\n';
-    }
+void output_integer(std::string & out, Simple::integer v)
+{
+  if (v < 0) {
+    out += '-';
+    output_uinteger(out, Simple::uinteger(0) - Simple::uinteger(v));
+  } else {
+    output_uinteger(out, Simple::uinteger(v));
   }
-  void do_comma() {
-    if (empty) {
-      empty = false;
-    } else {
-      stream << ',';
-    }
-    newline();
+}
+
+// Formatted as an ostream would by default, but always with a '.' for the decimal point
+void output_double(std::string & out, double v)
+{
+  char buf[32];
+  auto n = std::snprintf(buf, sizeof(buf), "%g", v);
+  auto point = std::localeconv()->decimal_point;
+  if (point[0] != '.' && point[0] && !point[1]) {
+    std::replace(buf, buf + n, point[0], '.');
   }
+  out.append(buf, std::size_t(n));
+}
+
+// Adapts a StreamWriter to walk a tree of nodes
+class Writer : public Visitor {
+ private:
+  StreamWriter & writer;
 
  public:
-  Writer(std::ostream & _stream, unsigned _indent = 0, unsigned _initial_indent = 0) :
-    stream(_stream), indent(_indent), current_indent(_initial_indent) {}
+  Writer(StreamWriter & w) : writer(w) {}
 
   bool data_number(double n) override {
-    return simple_write(n);
+    writer.value(n);
+    return true;
   }
   bool data_number(json::Simple::integer n) override {
-    return simple_write(n);
+    writer.value(n);
+    return true;
   }
   bool data_number(json::Simple::uinteger n) override {
-    return simple_write(n);
+    writer.value(n);
+    return true;
   }
   bool data_bool(bool b) override {
-    return simple_write(b ? "true" : "false");
+    writer.value(b);
+    return true;
   }
   bool data_null() override {
-    return simple_write("null");
+    writer.value(nullptr);
+    return true;
   }
   bool data_string(std::string const & s) override {
-    simple_indent();
-    output_string(stream, s);
+    writer.value(s);
     return true;
   }
   bool begin_array() override {
-    simple_indent();
-    stream << '[';
-    empty = true;
-    kv = false;
-    inc_indent();
+    writer.begin_array();
     return true;
   }
   bool end_array() override {
-    dec_indent();
-    if (!empty) {
-      newline();
-      do_indent();
-    }
-    stream << ']';
+    writer.end_array();
     return true;
   }
-  bool data_value(Node const & n) override {
-    if (!kv) {
-      do_comma();
-    }
-    auto rval = n.visit(*this);
-    kv = false;
-    empty = false;
-    return rval;
-  }
   bool begin_object() override {
-    simple_indent();
-    stream << '{';
-    empty = true;
-    inc_indent();
+    writer.begin_object();
     return true;
   }
   bool end_object() override {
-    dec_indent();
-    if (!empty) {
-      newline();
-      do_indent();
-    }
-    stream << '}';
+    writer.end_object();
     return true;
   }
   bool data_key(std::string const & k) override {
-    do_comma();
-    do_indent();
-    kv = true;
-    output_string(stream, k) << ": ";
+    writer.key(k);
+    return true;
+  }
+  bool data_key(char const * k) override {
+    writer.key(k);
     return true;
   }
 };
@@ -292,13 +326,121 @@ class Writer : public Visitor {
 
 namespace simple {
 
+class Builder;
+
+// The memory for the nodes of a Builder.  Nodes are carved out of large blocks, and once the
+// last of them is freed, as happens when a tree is built and destroyed for each record in
+// turn, the arena is reset so that the next tree reuses the blocks.  Each node is preceded by
+// a header recording its arena, which lets a node freed through a plain NodeRef find its way
+// back, and find the builder that made it.  The arena outlives its builder for as long as any
+// of its nodes do.  Like the builder, it must only be used by one thread at a time.
+class NodeArena {
+ public:
+  explicit NodeArena(Builder & b) : owner(&b) {}
+
+  // Allocate from the arena, or from the heap when arena is null
+  static void * allocate(NodeArena * arena, std::size_t size);
+  static void deallocate(void * p);
+
+  // The builder of the node allocated at p, or nullptr if it is gone or the node came from the
+  // heap
+  static Builder * builder(void const * p);
+
+  // The builder is being destroyed
+  void release();
+
+ private:
+  struct Header {
+    NodeArena * arena;
+  };
+  static constexpr std::size_t align = alignof(std::max_align_t);
+  static constexpr std::size_t header_size = (sizeof(Header) + align - 1) / align * align;
+  static constexpr std::size_t block_size = 64 * 1024;
+
+  static Header * header(void const * p) {
+    return reinterpret_cast<Header *>(const_cast<char *>(static_cast<char const *>(p))
+                                      - header_size);
+  }
+
+  std::vector<std::unique_ptr<char[]>> blocks;
+  std::size_t current = 0;      // The block being allocated from
+  std::size_t used = 0;         // Bytes used in the current block
+  std::size_t live = 0;         // Nodes not yet freed
+  Builder * owner;
+};
+
+void * NodeArena::allocate(NodeArena * arena, std::size_t size)
+{
+  size = header_size + (size + align - 1) / align * align;
+  char * mem;
+  if (!arena || size > block_size) {
+    mem = static_cast<char *>(::operator new(size));
+    arena = nullptr;
+  } else {
+    if (!arena->blocks.empty() && arena->used + size > block_size) {
+      ++arena->current;
+      arena->used = 0;
+    }
+    if (arena->current == arena->blocks.size()) {
+      arena->blocks.emplace_back(new char[block_size]);
+    }
+    mem = arena->blocks[arena->current].get() + arena->used;
+    arena->used += size;
+    ++arena->live;
+  }
+  reinterpret_cast<Header *>(mem)->arena = arena;
+  return mem + header_size;
+}
+
+void NodeArena::deallocate(void * p)
+{
+  auto h = header(p);
+  auto arena = h->arena;
+  if (!arena) {
+    ::operator delete(h);
+    return;
+  }
+  if (--arena->live == 0) {
+    if (!arena->owner) {
+      delete arena;
+      return;
+    }
+    arena->current = 0;
+    arena->used = 0;
+  }
+}
+
+Builder * NodeArena::builder(void const * p)
+{
+  auto arena = header(p)->arena;
+  return arena ? arena->owner : nullptr;
+}
+
+void NodeArena::release()
+{
+  owner = nullptr;
+  if (live == 0) {
+    delete this;
+  }
+}
+
 class Node : public virtual json::Node
 {
   static BuilderRef builder_;
 
  public:
-  json::Builder & builder() const override {
-    return *builder_;
+  // The builder that made the node, or if that is gone, a shared one
+  json::Builder & builder() const override;
+
+  // Nodes are allocated from their builder's NodeArena
+  static void * operator new(std::size_t size, NodeArena * arena) {
+    return NodeArena::allocate(arena, size);
+  }
+  static void operator delete(void * p, NodeArena *) {
+    NodeArena::deallocate(p);
+  }
+  static void operator delete(void * p) {
+    NodeArena::deallocate(p);
   }
 };
 
@@ -371,30 +513,57 @@ class Array : public Node, public json::Array
   }
 };
 
+// Members are kept in the order that they were added.  Keys must be unique, which is only
+// checked in debug builds.
 class Object : public Node, public json::Object {
-  std::map<std::string, NodeRef> map;
+  struct Member {
+    char const * key;           // Null when the key is owned
+    std::string owned;
+    NodeRef value;
+  };
+  std::vector<Member> members;
+
+  // An owned key can contain NULs, so keys are compared with their lengths
+  void check_unique(char const * key, std::size_t size) const {
+#ifndef NDEBUG
+    for (auto & m : members) {
+      auto n = m.key ? std::strlen(m.key) : m.owned.size();
+      assert(n != size || std::memcmp(m.key ? m.key : m.owned.data(), key, size) != 0);
+    }
+#else
+    static_cast<void>(key);
+    static_cast<void>(size);
+#endif
+  }
+
  public:
   using Node::builder;
 
   void add(std::string const & str, NodeRef o) override {
-    map.emplace(str, std::move(o));
+    add(std::string(str), std::move(o));
   }
   void add(std::string && str, NodeRef o) override {
-    map.emplace(std::move(str), std::move(o));
+    check_unique(str.data(), str.size());
+    members.push_back(Member{nullptr, std::move(str), std::move(o)});
+  }
+  void add(char const * key, NodeRef o) override {
+    check_unique(key, std::strlen(key));
+    members.push_back(Member{key, std::string(), std::move(o)});
   }
 
   void add(std::string const & str, json::Simple && v) override;
   void add(std::string && str, json::Simple && v) override;
+  void add(char const * key, json::Simple && v) override;
 
   bool visit(Visitor & v) const override {
     if (!v.begin_object()) {
       return false;
     }
-    for (auto & pair : map) {
-      if (!v.data_key(pair.first)) {
+    for (auto & m : members) {
+      if (!(m.key ? v.data_key(m.key) : v.data_key(m.owned))) {
         return false;
       }
-      if (!v.data_value(*pair.second)) {
+      if (!v.data_value(*m.value)) {
         return false;
       }
     }
@@ -407,36 +576,62 @@ class Builder : public json::Builder
  public:
   using json::Builder::simple;
 
+  // A pooled builder allocates its nodes from its own NodeArena, and otherwise from the heap
+  explicit Builder(bool pooled = true) : arena(pooled ? new NodeArena(*this) : nullptr) {}
+  ~Builder() override {
+    if (arena) {
+      arena->release();
+    }
+  }
+  Builder(Builder const &) = delete;
+  Builder & operator=(Builder const &) = delete;
+
   NodeRef simple(json::Simple::integer i) const override {
-    return json::make_unique<Number<json::Simple::integer>>(i);
+    return make<Number<json::Simple::integer>>(i);
   }
   NodeRef simple(json::Simple::uinteger i) const override {
-    return json::make_unique<Number<json::Simple::uinteger>>(i);
+    return make<Number<json::Simple::uinteger>>(i);
   }
   NodeRef simple(double d) const override {
-    return json::make_unique<Number<double>>(d);
+    return make<Number<double>>(d);
   }
   NodeRef simple(bool b) const override {
-    return json::make_unique<Bool>(b);
+    return make<Bool>(b);
   }
   NodeRef null() const override {
-    return json::make_unique<Null>();
+    return make<Null>();
   }
   NodeRef simple(std::string && s) const override {
-    return json::make_unique<String>(std::move(s));
+    return make<String>(std::move(s));
   }
   NodeRef simple(std::string const & s) const override {
-    return json::make_unique<String>(s);
+    return make<String>(s);
   }
   ArrayRef array() const override {
-    return json::make_unique<Array>();
+    return make<Array>();
   }
   ObjectRef object() const override {
-    return json::make_unique<Object>();
+    return make<Object>();
+  }
+
+ private:
+  template <typename T, typename... Args>
+  std::unique_ptr<T> make(Args &&... args) const {
+    return std::unique_ptr<T>(new (arena) T(std::forward<Args>(args)...));
   }
+
+  NodeArena * arena;
 };
 
-BuilderRef Node::builder_ = json::simple_builder();
+// Shared by nodes whose builder is gone, and so by any thread, which is why it isn't pooled
+BuilderRef Node::builder_ = json::make_unique<Builder>(false);
+
+json::Builder & Node::builder() const
+{
+  // The node's allocation starts at its most derived object
+  auto b = NodeArena::builder(dynamic_cast<void const *>(this));
+  return b ? *b : *builder_;
+}
 
 void Array::add(json::Simple && v) {
   add(builder().simple(std::move(v)));
@@ -450,6 +645,10 @@ void Object::add(std::string && str, json::Simple && v) {
   add(std::move(str), builder().simple(std::move(v)));
 }
 
+void Object::add(char const * key, json::Simple && v) {
+  add(key, builder().simple(std::move(v)));
+}
+
 } // namespace simple
 
 namespace {
@@ -457,10 +656,200 @@ const int indent_idx = std::ios_base::xalloc();
 const int initial_indent_idx = std::ios_base::xalloc();
 }
 
-std::ostream & operator<<(std::ostream & stream, Node const & n)
+StreamWriter::StreamWriter(std::ostream & stream)
+  : StreamWriter(stream, unsigned(stream.iword(indent_idx)),
+                 unsigned(stream.iword(initial_indent_idx)))
+{}
+
+StreamWriter::StreamWriter(std::ostream & stream, unsigned indent, unsigned initial_indent)
+  : stream_(&stream), out_(&buffer_), indent_(indent), current_indent_(initial_indent)
+{
+  buffer_.reserve(flush_size);
+}
+
+StreamWriter::StreamWriter(std::string & out, unsigned indent, unsigned initial_indent)
+  : out_(&out), indent_(indent), current_indent_(initial_indent)
+{}
+
+StreamWriter::~StreamWriter()
+{
+  flush();
+}
+
+void StreamWriter::flush()
+{
+  if (stream_ && !buffer_.empty()) {
+    stream_->write(buffer_.data(), std::streamsize(buffer_.size()));
+    buffer_.clear();
+  }
+}
+
+void StreamWriter::do_indent()
+{
+  out_->append(current_indent_, ' ');
+}
+
+void StreamWriter::newline()
+{
+  if (indent_) {
+    *out_ += '\n';
+  }
+}
+
+void StreamWriter::do_comma()
+{
+  if (empty_) {
+    empty_ = false;
+  } else {
+    *out_ += ',';
+  }
+  newline();
+}
+
+// A value following a key goes on the same line as the key.  Any other value within a
+// container is an array element, which gets its own line.
+void StreamWriter::begin_value()
+{
+  if (buffer_.size() >= flush_size) {
+    flush();
+  }
+  if (kv_) {
+    kv_ = false;
+    return;
+  }
+  if (depth_) {
+    do_comma();
+  }
+  do_indent();
+}
+
+void StreamWriter::begin_object()
+{
+  begin_value();
+  *out_ += '{';
+  empty_ = true;
+  current_indent_ += indent_;
+  ++depth_;
+}
+
+void StreamWriter::end_object()
 {
-  Writer w(stream, stream.iword(indent_idx), stream.iword(initial_indent_idx));
+  current_indent_ -= indent_;
+  --depth_;
+  if (!empty_) {
+    newline();
+    do_indent();
+  }
+  *out_ += '}';
+  empty_ = false;
+}
+
+void StreamWriter::begin_array()
+{
+  begin_value();
+  *out_ += '[';
+  empty_ = true;
+  current_indent_ += indent_;
+  ++depth_;
+}
+
+void StreamWriter::end_array()
+{
+  current_indent_ -= indent_;
+  --depth_;
+  if (!empty_) {
+    newline();
+    do_indent();
+  }
+  *out_ += ']';
+  empty_ = false;
+}
+
+void StreamWriter::key(char const * k, std::size_t n)
+{
+  do_comma();
+  do_indent();
+  kv_ = true;
+  output_string(*out_, k, n);
+  out_->append(": ", 2);
+}
+
+void StreamWriter::key(std::string const & k)
+{
+  key(k.data(), k.size());
+}
+
+void StreamWriter::key(char const * k)
+{
+  key(k, std::strlen(k));
+}
+
+void StreamWriter::integer(Simple::integer v)
+{
+  begin_value();
+  output_integer(*out_, v);
+  empty_ = false;
+}
+
+void StreamWriter::uinteger(Simple::uinteger v)
+{
+  begin_value();
+  output_uinteger(*out_, v);
+  empty_ = false;
+}
+
+void StreamWriter::value(double v)
+{
+  begin_value();
+  output_double(*out_, v);
+  empty_ = false;
+}
+
+void StreamWriter::value(bool v)
+{
+  begin_value();
+  if (v) {
+    out_->append("true", 4);
+  } else {
+    out_->append("false", 5);
+  }
+  empty_ = false;
+}
+
+void StreamWriter::value(std::nullptr_t)
+{
+  begin_value();
+  out_->append("null", 4);
+  empty_ = false;
+}
+
+void StreamWriter::value(std::string const & v)
+{
+  begin_value();
+  output_string(*out_, v.data(), v.size());
+  empty_ = false;
+}
+
+void StreamWriter::value(char const * v)
+{
+  if (!v) {
+    value(nullptr);
+    return;
+  }
+  begin_value();
+  output_string(*out_, v, std::strlen(v));
+  empty_ = false;
+}
+
+void StreamWriter::value(Node const & n)
+{
+  Writer w(*this);
   n.visit(w);
+}
+
+std::ostream & operator<<(std::ostream & stream, Node const & n)
+{
+  StreamWriter(stream).value(n);
   return stream;
 }
 
@@ -28,6 +28,7 @@
 #include <ostream>              // std::ostream
 #include <cstdint>              // std::nullptr_t, std::intmax_t, std::uintmax_t
 #include <string>               // std::string
+#include <utility>              // std::forward, std::move
 
 namespace json {
 
@@ -58,6 +59,14 @@ class Object : public virtual Node {
   virtual void add(std::string const & str, Simple && v) = 0;
   virtual void add(std::string && str, NodeRef o) = 0;
   virtual void add(std::string && str, Simple && v) = 0;
+  // Keys given as a char const * may be kept without being copied, so they must outlive the
+  // object, as string literals do
+  virtual void add(char const * key, NodeRef o) {
+    add(std::string(key), std::move(o));
+  }
+  virtual void add(char const * key, Simple && v) {
+    add(std::string(key), std::move(v));
+  }
 };
 
 using ObjectRef = std::unique_ptr<Object>;
@@ -125,6 +134,7 @@ class Visitor {
   virtual bool begin_object() { return do_nothing(); }
   virtual bool end_object() { return do_nothing(); }
   virtual bool data_key(std::string const &) { return do_nothing(); }
+  virtual bool data_key(char const * k) { return data_key(std::string(k)); }
   virtual bool data_value(Node const & n) { return n.visit(*this); }
 };
 
@@ -169,6 +179,78 @@ class pretty {
 };
 std::ostream & operator<<(std::ostream & stream, pretty const & p);
 
+// Writes JSON to a stream as it is described, without building a tree of nodes.  Members and
+// elements are written in the order that they are given.  It is up to the caller to balance
+// the begin and end calls, and to not repeat keys within an object.  The formatting is the
+// same as writing an equivalent tree with operator<<.
+//
+// The text is collected in a buffer, which is written to the stream in large chunks, and when
+// the writer is flushed or destroyed.
+class StreamWriter {
+ public:
+  // Uses the indentation set on the stream by pretty()
+  explicit StreamWriter(std::ostream & stream);
+  StreamWriter(std::ostream & stream, unsigned indent, unsigned initial_indent = 0);
+  // Appends to a string instead, which is never flushed
+  StreamWriter(std::string & out, unsigned indent = 0, unsigned initial_indent = 0);
+  StreamWriter(StreamWriter const &) = delete;
+  StreamWriter & operator=(StreamWriter const &) = delete;
+  ~StreamWriter();
+
+  void flush();
+
+  void begin_object();
+  void end_object();
+  void begin_array();
+  void end_array();
+  void key(std::string const & k);
+  void key(char const * k);
+
+  void value(short int v) { integer(v); }
+  void value(unsigned short int v) { uinteger(v); }
+  void value(int v) { integer(v); }
+  void value(unsigned int v) { uinteger(v); }
+  void value(long int v) { integer(v); }
+  void value(unsigned long int v) { uinteger(v); }
+  void value(long long int v) { integer(v); }
+  void value(unsigned long long int v) { uinteger(v); }
+  void value(double v);
+  void value(bool v);
+  void value(std::nullptr_t);
+  void value(std::string const & v);
+  void value(char const * v);
+  void value(Node const & n);
+
+  template <typename T>
+  void member(char const * k, T && v) {
+    key(k);
+    value(std::forward<T>(v));
+  }
+
+ private:
+  static constexpr std::size_t flush_size = 1 << 16;
+
+  void key(char const * k, std::size_t n);
+  void integer(Simple::integer v);
+  void uinteger(Simple::uinteger v);
+  void begin_value();
+  void do_comma();
+  void do_indent();
+  void newline();
+
+  std::ostream * stream_ = nullptr;
+  std::string buffer_;
+  std::string * out_;
+  unsigned indent_;
+  unsigned current_indent_;
+  unsigned depth_ = 0;
+  bool empty_ = true;
+  bool kv_ = false;
+};
+
+// A builder of in-memory nodes.  Its nodes are allocated from memory that it owns, and which
+// is reused once they have all been freed, so a builder and its nodes must only be used by one
+// thread at a time.  The nodes may outlive the builder.
 BuilderRef simple_builder();
 
 } // namespace json
@@ -39,7 +39,7 @@ pydemanglemodule = Extension("pydemangle",
                         include_dirs = [os.path.join(os.getcwd(), 'libdemangle'), os.getcwd(),],
                         libraries = libraries,
                         library_dirs = [os.getcwd(),],
-                        sources = ['libdemangle/codes.cpp', 'libdemangle/json.cpp', 'libdemangle/demangle_json.cpp', 'libdemangle/demangle.cpp', 'libdemangle/demangle_text.cpp', 'src/pydemanglemodule.cpp'],
+                        sources = ['libdemangle/codes.cpp', 'libdemangle/json.cpp', 'libdemangle/demangle_json.cpp', 'libdemangle/demangle.cpp', 'libdemangle/itanium.cpp', 'libdemangle/demangle_text.cpp', 'libdemangle/demangle_binary.cpp', 'libdemangle/demangle_store.cpp', 'src/pydemanglemodule.cpp'],
                         extra_compile_args=["-std=c++11", "-Wall"],
                         language='c++11')
 
@@ -33,6 +33,8 @@
 #include <libdemangle/demangle.hpp>
 #include <libdemangle/demangle_json.hpp>
 #include <libdemangle/demangle_text.hpp>
+#include <libdemangle/demangle_binary.hpp>
+#include <libdemangle/demangle_store.hpp>
 #include <libdemangle/json.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/program_options.hpp>
@@ -43,6 +45,9 @@ using demangle::JsonOutput;
 using demangle::TextOutput;
 using demangle::TextAttributes;
 using demangle::TextAttribute;
+using demangle::TextDictionary;
+using demangle::SymbolStore;
+using demangle::SymbolStoreWriter;
 using json::Builder;
 
 class Demangler {
@@ -53,9 +58,20 @@ class Demangler {
   bool raw = false;
   bool minimal = false;
   bool batch = false;
+  bool partial = false;
   std::unique_ptr<Builder> builder;
   std::unique_ptr<JsonOutput> json_output;
+  std::unique_ptr<TextDictionary> dictionary;
+  bool dag = false;
+  bool compact = false;
+  bool binary = false;
+  std::unique_ptr<SymbolStore> store;
+  std::unique_ptr<SymbolStoreWriter> store_writer;
   mutable demangle::TextOutput str;
+  mutable std::string line;
+  mutable demangle::TextComponents components;
+  mutable std::string record;
+  unsigned json_indent = 0;
 
  public:
   void set_attributes(TextAttributes a) {
@@ -65,6 +81,67 @@ class Demangler {
       json_output->set_attributes(attr);
     }
   }
+  void set_max_length(std::size_t n) {
+    str.set_max_length(n);
+    if (json_output) {
+      json_output->set_max_length(n);
+    }
+  }
+  void set_max_output(std::size_t n) {
+    str.set_max_output(n);
+    if (json_output) {
+      json_output->set_max_output(n);
+    }
+  }
+  void set_max_template_depth(std::size_t n) {
+    str.set_max_template_depth(n);
+    if (json_output) {
+      json_output->set_max_template_depth(n);
+    }
+  }
+  void set_compact(bool val) {
+    compact = val;
+  }
+  void set_binary(bool val) {
+    binary = val;
+  }
+  // Throws a demangle::Error if the store can't be opened
+  void set_store(std::string const & path) {
+    store = std::unique_ptr<SymbolStore>(new SymbolStore(path));
+  }
+  SymbolStore const * get_store() const {
+    return store.get();
+  }
+  void set_store_writer(bool val) {
+    if (val) {
+      store_writer = std::unique_ptr<SymbolStoreWriter>(new SymbolStoreWriter());
+    } else {
+      store_writer.reset();
+    }
+  }
+  void write_store(std::string const & path) const {
+    store_writer->write(path);
+  }
+  void set_dag(bool val) {
+    dag = val;
+    if (json_output) {
+      json_output->set_dag(dag);
+    }
+  }
+  void set_dictionary(bool val) {
+    if (val) {
+      dictionary = std::unique_ptr<TextDictionary>(new TextDictionary());
+    } else {
+      dictionary.reset();
+    }
+    str.set_dictionary(dictionary.get());
+    if (json_output) {
+      json_output->set_dictionary(dictionary.get());
+    }
+  }
+  void set_pretty(bool val) {
+    json_indent = val ? 4 : 0;
+  }
   void set_nosym(bool val) {
     nosym = val;
   }
@@ -83,12 +160,20 @@ class Demangler {
   void set_batch(bool val) {
     batch = val;
   }
+  void set_partial(bool val) {
+    partial = val;
+  }
   void set_json(bool val) {
     if (val) {
       if (!builder) {
         builder = json::simple_builder();
         json_output = std::unique_ptr<JsonOutput>(new JsonOutput(*builder));
         json_output->set_attributes(attr);
+        json_output->set_max_length(str.get_max_length());
+        json_output->set_max_output(str.get_max_output());
+        json_output->set_max_template_depth(str.get_max_template_depth());
+        json_output->set_dictionary(dictionary.get());
+        json_output->set_dag(dag);
       }
     } else {
       builder.reset();
@@ -97,50 +182,261 @@ class Demangler {
   }
 
   bool demangle(std::string const & mangled) const;
+  void output_header() const;
+  void write_dictionary(std::ostream & stream, bool pretty) const;
   bool operator()(std::string const & mangled) const {
     return demangle(mangled);
   }
+
+ private:
+  void json_write(json::StreamWriter & w, demangle::DemangledType const & t) const;
+  bool output_stored(std::string const & mangled, std::size_t i) const;
+  void flush_record() const;
+  void output(std::string const & mangled, demangle::DemangledType const & t) const;
+  void output_error(std::string const & mangled, char const * error,
+                    demangle::DemangleResult const * result = nullptr) const;
+  void write_error(std::string const & mangled, char const * error,
+                   demangle::DemangleResult const * result, bool with_partial) const;
+  template <typename Writer>
+  void write_error_members(Writer & w, std::string const & mangled, char const * error,
+                           demangle::DemangleResult const * result, bool with_partial) const;
 };
 
+void Demangler::json_write(json::StreamWriter & w, demangle::DemangledType const & t) const
+{
+  if (raw) {
+    json_output->raw(w, t);
+  } else if (minimal) {
+    json_output->minimal(w, t);
+  } else {
+    json_output->convert(w, t);
+  }
+}
+
+void Demangler::flush_record() const
+{
+  std::cout.write(record.data(), std::streamsize(record.size()));
+  if (binary) {
+    // Binary records are self-delimiting, so a batch only needs them sent right away
+    if (batch) {
+      std::cout.flush();
+    }
+  } else if (batch) {
+    std::cout << std::endl;
+  }
+}
+
+void Demangler::output(std::string const & mangled, demangle::DemangledType const & t) const
+{
+  if (binary) {
+    record.clear();
+    demangle::BinaryWriter(record).record(mangled, t);
+    flush_record();
+  } else if (builder) {
+    // The record is written out only once it is complete, as the output budget can stop it
+    // part way through
+    record.clear();
+    json::StreamWriter w(record, json_indent);
+    if (compact) {
+      str.components(t, components);
+      demangle::CompactWriter cw(w);
+      cw.begin_record();
+      cw.member("symbol", mangled);
+      cw.member("demangled", components.str(components.text));
+      json_output->minimal(cw, t, components);
+      cw.end_record();
+      flush_record();
+      return;
+    }
+    w.begin_object();
+    w.member("symbol", mangled);
+    if (minimal && !raw) {
+      // Walk the symbol once for both the minimal output and the demangled text
+      str.components(t, components);
+      w.member("demangled", components.str(components.text));
+      json_output->minimal(w, t, components);
+    } else {
+      w.member("demangled", str.convert(t));
+      json_write(w, t);
+    }
+    w.end_object();
+    flush_record();
+  } else {
+    if (!nosym) {
+      std::cout << mangled << " ";
+    }
+    line.clear();
+    str.append(line, t);
+    std::cout << line << std::endl;
+  }
+}
+
+// The writer that nested values of a record are written to
+json::StreamWriter & stream_of(json::StreamWriter & w)
+{
+  return w;
+}
+json::StreamWriter & stream_of(demangle::CompactWriter & w)
+{
+  return w.stream();
+}
+
+template <typename Writer>
+void Demangler::write_error_members(
+  Writer & w, std::string const & mangled, char const * error,
+  demangle::DemangleResult const * result, bool with_partial) const
+{
+  w.member("symbol", mangled);
+  w.member("error", error);
+  if (result) {
+    w.member("error_offset", result->error_offset);
+    if (with_partial && result->symbol) {
+      w.key("partial");
+      auto & sw = stream_of(w);
+      sw.begin_object();
+      json_write(sw, *result->symbol);
+      sw.end_object();
+    }
+  }
+}
+
+void Demangler::write_error(std::string const & mangled, char const * error,
+                            demangle::DemangleResult const * result, bool with_partial) const
+{
+  record.clear();
+  json::StreamWriter w(record, json_indent);
+  if (compact) {
+    demangle::CompactWriter cw(w);
+    cw.begin_record();
+    write_error_members(cw, mangled, error, result, with_partial);
+    cw.end_record();
+  } else {
+    w.begin_object();
+    write_error_members(w, mangled, error, result, with_partial);
+    w.end_object();
+  }
+}
+
+void Demangler::output_header() const
+{
+  if (binary) {
+    record.clear();
+    demangle::BinaryWriter(record).header();
+    flush_record();
+  } else if (compact) {
+    record.clear();
+    json::StreamWriter w(record, json_indent);
+    demangle::CompactWriter(w).header();
+    flush_record();
+  }
+}
+
+void Demangler::output_error(std::string const & mangled, char const * error,
+                             demangle::DemangleResult const * result) const
+{
+  if (binary) {
+    record.clear();
+    demangle::BinaryWriter w(record);
+    if (result) {
+      w.record(mangled, *result);
+    } else {
+      demangle::DemangleResult failed;
+      failed.error = error;
+      w.record(mangled, failed);
+    }
+    flush_record();
+  } else if (builder) {
+    try {
+      write_error(mangled, error, result, true);
+    } catch (demangle::OutputBudgetExceeded const &) {
+      // The partial symbol exceeds the output budget, so leave it out
+      write_error(mangled, error, result, false);
+    }
+    flush_record();
+  } else if (noerror) {
+    std::cout << mangled << std::endl;
+  } else {
+    std::cout << "! " <<  mangled << " " << error;
+    if (result && result->symbol) {
+      line.clear();
+      try {
+        str.append(line, *result->symbol);
+        // A partial symbol can be too incomplete to have any text
+        if (!line.empty()) {
+          std::cout << " (partial: " << line << ")";
+        }
+      } catch (demangle::OutputBudgetExceeded const &) {
+        // The partial symbol exceeds the output budget, so leave it out
+      }
+    }
+    std::cout << std::endl;
+  }
+}
+
+// Output a symbol from the store as if it had just been demangled
+bool Demangler::output_stored(std::string const & mangled, std::size_t i) const
+{
+  auto result = store->load(i);
+  if (!result.ok()) {
+    output_error(mangled, result.error.c_str(), partial ? &result : nullptr);
+    return false;
+  }
+  output(mangled, *result.symbol);
+  return true;
+}
+
 bool Demangler::demangle(std::string const & mangled) const
 {
   try {
-    auto t = demangle::visual_studio_demangle(mangled, debug);
-    if (builder) {
-      auto node = raw ? json_output->raw(*t) :
-                  (minimal ? json_output->minimal(*t) : json_output->convert(*t));
-      node->add("symbol", mangled);
-      node->add("demangled", str.convert(*t));
-      std::cout << *node;
-      if (batch) {
-        std::cout << std::endl;
+    if (store_writer) {
+      auto result = demangle::demangle_partial(mangled, debug);
+      store_writer->add(mangled, result);
+      return result.ok();
+    }
+    if (store) {
+      auto i = store->find(mangled);
+      if (i != SymbolStore::npos) {
+        return output_stored(mangled, i);
       }
-    } else {
-      if (!nosym) {
-        std::cout << mangled << " ";
+    }
+    if (partial) {
+      auto result = demangle::demangle_partial(mangled, debug);
+      if (!result.ok()) {
+        output_error(mangled, result.error.c_str(), &result);
+        return false;
       }
-      std::cout << str(*t) << std::endl;
+      output(mangled, *result.symbol);
+    } else {
+      output(mangled, *demangle::demangle(mangled, debug));
     }
     return true;
   }
   catch (const demangle::Error& e) {
-    if (builder) {
-      auto node = builder->object();
-      node->add("symbol", mangled);
-      node->add("error", e.what());
-      std::cout << *node;
-      if (batch) {
-        std::cout << std::endl;
-      }
-    } else if (noerror) {
-      std::cout << mangled << std::endl;
-    } else {
-      std::cout << "! " <<  mangled << " " << e.what() << std::endl;
-    }
+    output_error(mangled, e.what());
     return false;
   }
 }
 
+void Demangler::write_dictionary(std::ostream & stream, bool pretty) const
+{
+  if (!builder) {
+    for (auto & entry : dictionary->entries()) {
+      stream << entry.first << ' ' << entry.second << '\n';
+    }
+    return;
+  }
+  if (pretty) {
+    stream << json::pretty();
+  }
+  json::StreamWriter w(stream);
+  w.begin_object();
+  for (auto & entry : dictionary->entries()) {
+    w.member(entry.first.c_str(), entry.second);
+  }
+  w.end_object();
+  stream << std::endl;
+}
+
 struct Driver {
   bool first;
   bool nofile = false;
@@ -150,6 +446,7 @@ struct Driver {
   Demangler const & demangler;
   Driver(Demangler const & d) : demangler(d) {}
   bool demangle_file(std::istream & file);
+  bool demangle_store(SymbolStore const & store);
   bool demangle(std::string const & sym);
   bool run(std::vector<std::string> const & args);
 };
@@ -164,6 +461,15 @@ bool Driver::demangle_file(std::istream & file)
   return success;
 }
 
+bool Driver::demangle_store(SymbolStore const & store)
+{
+  bool success = true;
+  for (std::size_t i = 0; i < store.size(); ++i) {
+    success &= demangle(store.mangled(i).str());
+  }
+  return success;
+}
+
 bool Driver::demangle(std::string const & sym)
 {
   if (json) {
@@ -185,7 +491,12 @@ bool Driver::run(std::vector<std::string> const & args)
   if (json && !batch) {
     std::cout << '[';
   }
+  demangler.output_header();
   bool success = true;
+  if (args.empty() && demangler.get_store()) {
+    // Every symbol in the store
+    success = demangle_store(*demangler.get_store());
+  }
   bool dd = false;
   for (auto & arg : args) {
     if (!dd && arg == "--") {
@@ -241,11 +552,31 @@ int main(int argc, char **argv)
     ("nosym,n",   "Only output the demangled name, not the symbol")
     ("nofile",    "Interpret arguments only as symbols, not at filenames")
     ("noerror",   "If a symbol fails to demangle, just output the mangled name")
+    ("partial",   "If a symbol fails to demangle, also output what was demangled")
     ("debug,d",   "Output demangling debugging spew to stderr")
     ("json,j", po::value<std::string>(),
      "JSON output (\"raw\" or \"minimal\"")
     ("pretty,p",  "Output human-readable JSON if outputting JSON")
     ("batch",     "JSON objects are newline-separated, rather than in a list")
+    ("dag",       "In raw JSON, output repeated types once, and refer back to them by id")
+    ("compact",   "With --json minimal --batch, output each symbol as an array of fields, "
+                  "after a header that lists the fields")
+    ("max-length", po::value<std::size_t>(),
+     "Abbreviate demangled names longer than this with \"...\"")
+    ("max-output", po::value<std::size_t>(),
+     "Fail to demangle symbols whose output would be longer than this")
+    ("max-template-depth", po::value<std::size_t>(),
+     "Abbreviate template arguments nested deeper than this as \"<...>\"")
+    ("dictionary", po::value<std::string>(),
+     "Replace repeated template types with aliases, which are written to this file")
+    ("store", po::value<std::string>(),
+     "Take symbols from this symbol store rather than demangling them, or with no "
+     "arguments, output every symbol in it")
+    ("write-store", po::value<std::string>(),
+     "Rather than outputting the symbols, write them to this symbol store")
+    ("format", po::value<std::string>(),
+     "Output format: \"text\" (the default), or \"binary\" for the binary encoding "
+     "of the parsed symbols")
     ;
 
   po::options_description hidden;
@@ -354,6 +685,9 @@ int main(int argc, char **argv)
   if (vm.count("noerror")) {
     demangler.set_noerror(true);
   }
+  if (vm.count("partial")) {
+    demangler.set_partial(true);
+  }
   if (vm.count("json")) {
     demangler.set_json(true);
     auto & val = vm["json"].as<std::string>();
@@ -369,11 +703,76 @@ int main(int argc, char **argv)
   if (vm.count("batch")) {
     demangler.set_batch(true);
   }
+  if (vm.count("pretty")) {
+    demangler.set_pretty(true);
+  }
+  if (vm.count("dag")) {
+    demangler.set_dag(true);
+  }
+  if (vm.count("compact")) {
+    if (!vm.count("json") || vm["json"].as<std::string>() != "minimal" || !vm.count("batch")) {
+      std::cerr << "The --compact option requires --json minimal and --batch" << std::endl;
+      return EXIT_FAILURE;
+    }
+    demangler.set_compact(true);
+  }
+  if (vm.count("format")) {
+    auto & val = vm["format"].as<std::string>();
+    if (val == "binary") {
+      if (vm.count("json") || vm.count("dictionary")) {
+        std::cerr << "The binary format cannot be used with --json or --dictionary"
+                  << std::endl;
+        return EXIT_FAILURE;
+      }
+      demangler.set_binary(true);
+    } else if (val != "text") {
+      std::cerr << "The --format value must be either \"text\" or \"binary\"" << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  if (vm.count("max-length")) {
+    demangler.set_max_length(vm["max-length"].as<std::size_t>());
+  }
+  if (vm.count("max-output")) {
+    demangler.set_max_output(vm["max-output"].as<std::size_t>());
+  }
+  if (vm.count("max-template-depth")) {
+    demangler.set_max_template_depth(vm["max-template-depth"].as<std::size_t>());
+  }
+  std::ofstream dictionary;
+  if (vm.count("dictionary")) {
+    auto & path = vm["dictionary"].as<std::string>();
+    dictionary.open(path);
+    if (!dictionary) {
+      std::cerr << "Could not open dictionary file " << path << std::endl;
+      return EXIT_FAILURE;
+    }
+    demangler.set_dictionary(true);
+  }
+  if (vm.count("write-store")) {
+    if (vm.count("json") || vm.count("store") || vm.count("format")) {
+      std::cerr << "The --write-store option cannot be used with --json, --store, or --format"
+                << std::endl;
+      return EXIT_FAILURE;
+    }
+    demangler.set_store_writer(true);
+  }
+  if (vm.count("store")) {
+    try {
+      demangler.set_store(vm["store"].as<std::string>());
+    } catch (demangle::Error const & e) {
+      std::cerr << e.what() << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
   std::vector<std::string> args;
   if (vm.count("args")) {
     args = vm["args"].as<std::vector<std::string>>();
   }
-  if (args.empty() && (std::cin.peek() != std::istream::traits_type::eof())) {
+  bool whole_store = args.empty() && vm.count("store");
+  if (args.empty() && !whole_store
+      && (std::cin.peek() != std::istream::traits_type::eof()))
+  {
     // If there are no arguments, but we have stdin, add stdin
     args.push_back("-");
   }
@@ -398,7 +797,7 @@ int main(int argc, char **argv)
       ++count;
     }
   }
-  if (count == 0) {
+  if (count == 0 && !whole_store) {
     std::cerr << "No symbols or filenames were given" << std::endl;
     return EXIT_FAILURE;
   }
@@ -410,6 +809,17 @@ int main(int argc, char **argv)
   driver.pretty = vm.count("pretty");
   driver.batch = vm.count("batch");
   bool success = driver.run(args);
+  if (vm.count("write-store")) {
+    try {
+      demangler.write_store(vm["write-store"].as<std::string>());
+    } catch (demangle::Error const & e) {
+      std::cerr << e.what() << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  if (dictionary.is_open()) {
+    demangler.write_dictionary(dictionary, driver.pretty);
+  }
 
   return success ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -38,7 +38,7 @@ PyObject* pythondemangle(char* mangled)
         json_output = std::unique_ptr<demangle::JsonOutput>(new JsonOutput(*builder));
 
         bool debug = false;
-        auto t = demangle::visual_studio_demangle(mangled, debug);
+        auto t = demangle::demangle(mangled, debug);
 
         auto node = json_output->minimal(*t);
         node->add("symbol", mangled);